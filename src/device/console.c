@@ -29,6 +29,13 @@ void console_put_char(uint8_t ch) {
     console_release();
 }
 
+// 输出 buf 中的 len 个字符，整段只申请一次锁
+void console_write(const char* buf, uint32_t len) {
+    console_acquire();
+    while (len--) put_char(*buf++);
+    console_release();
+}
+
 void console_put_int(uint32_t num) {
     console_acquire();
     put_int(num);
@@ -0,0 +1,94 @@
+#include <device/elevator.h>
+#include <device/ide.h>
+#include <kernel/list.h>
+#include <kernel/debug.h>
+#include <kernel/global.h>
+#include <kernel/interrupt.h>
+#include <lib/kernel/stdio-kernel.h>
+
+/**
+ * 磁盘请求的电梯调度（C-LOOK）.
+ * 请求队列按扇区地址升序排列，新的 bio 能与已排队的请求首尾相接时合并成一条命令，
+ * 下发时从上一个请求结束的位置向上找第一个请求，到顶后回到最小的地址重新开始。
+ * 以下函数都在关中断下调用。
+ */
+
+// 排序用的键，同一通道上主盘的请求排在从盘前面，lba 不超过28位
+static uint32_t elv_key(struct disk* hd, uint32_t lba) {
+    return ((uint32_t)hd->dev_no << 28) | lba;
+}
+
+// 尝试把 bio 合并到已排队的请求 req 中，成功返回true
+static bool elv_try_merge(struct ide_channel* channel, struct bio* req, struct bio* bio) {
+    if (req->hd != bio->hd || req->rw != bio->rw) return false;
+    if (req->req_secs + bio->sec_cnt > ELV_MAX_REQ_SECS) return false;
+
+    if (req->lba + req->req_secs == bio->lba) {           // 接在请求的后面
+        struct bio* tail = req;
+        while (tail->merge_next != NULL) tail = tail->merge_next;
+        tail->merge_next = bio;
+        req->req_secs += bio->sec_cnt;
+    } else if (bio->lba + bio->sec_cnt == req->lba) {     // 接在请求的前面，bio 成为新的队首
+        list_insert_before(&req->queue_tag, &bio->queue_tag);
+        list_remove(&req->queue_tag);
+        bio->merge_next = req;
+        bio->req_secs = bio->sec_cnt + req->req_secs;
+    } else {
+        return false;
+    }
+
+    channel->merge_cnt++;
+    return true;
+}
+
+// 将 bio 按扇区地址插入请求队列，能合并的就合并
+void elv_add_bio(struct ide_channel* channel, struct bio* bio) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    bio->merge_next = NULL;
+    bio->req_secs = bio->sec_cnt;
+
+    uint32_t key = elv_key(bio->hd, bio->lba);
+    struct list_elem* elem = channel->bio_queue.head.next;
+    while (elem != &channel->bio_queue.tail) {
+        struct bio* req = elem2entry(struct bio, queue_tag, elem);
+        if (elv_try_merge(channel, req, bio)) return;
+        if (elv_key(req->hd, req->lba) > key) break;
+        elem = elem->next;
+    }
+
+    list_insert_before(elem, &bio->queue_tag);
+    channel->queue_depth++;
+    if (channel->queue_depth > channel->max_depth) channel->max_depth = channel->queue_depth;
+}
+
+// 按 C-LOOK 取出下一个要执行的请求，队列为空返回NULL
+struct bio* elv_next_request(struct ide_channel* channel) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    if (list_empty(&channel->bio_queue)) return NULL;
+
+    struct list_elem* elem = channel->bio_queue.head.next;
+    while (elem != &channel->bio_queue.tail) {
+        struct bio* req = elem2entry(struct bio, queue_tag, elem);
+        if (elv_key(req->hd, req->lba) >= channel->head_key) break;
+        elem = elem->next;
+    }
+    if (elem == &channel->bio_queue.tail) { // 上面已经没有请求了，回到最小的地址
+        elem = channel->bio_queue.head.next;
+    }
+    list_remove(elem);
+
+    struct bio* req = elem2entry(struct bio, queue_tag, elem);
+    channel->depth_sum += channel->queue_depth;
+    channel->queue_depth--;
+    channel->dispatch_cnt++;
+    channel->head_key = elv_key(req->hd, req->lba) + req->req_secs;
+    return req;
+}
+
+// 打印通道的调度统计信息
+void elv_print_stat(struct ide_channel* channel) {
+    uint32_t avg_depth = channel->dispatch_cnt ? channel->depth_sum / channel->dispatch_cnt : 0;
+    printk("%s: dispatch %d, merge %d, depth %d, max depth %d, avg depth %d\n", \
+           channel->name, channel->dispatch_cnt, channel->merge_cnt, \
+           channel->queue_depth, channel->max_depth, avg_depth);
+}
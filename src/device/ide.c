@@ -1,10 +1,12 @@
 #include <device/ide.h>
+#include <device/elevator.h>
 #include <device/timer.h>
 #include <device/console.h>
 #include <kernel/io.h>
 #include <kernel/debug.h>
 #include <kernel/global.h>
 #include <kernel/memory.h>
+#include <kernel/interrupt.h>
 #include <lib/stdio.h>
 #include <lib/kernel/stdint.h>
 #include <lib/kernel/stdio-kernel.h>
@@ -27,6 +29,7 @@
 #define BIT_STAT_BSY    0x80    // 硬盘忙
 #define BIT_STAT_DRDY   0x40    // 驱动器准备好了
 #define BIT_STAT_DRQ    0x8     // 数据传输准备好了
+#define BIT_STAT_ERR    0x1     // 上一条命令出错
 
 // device
 #define BIT_DEV_MBS     0xa0    // 指device中的第5位和第7位，两位固定为1
@@ -37,6 +40,9 @@
 #define CMD_IDENTIFY     0xec   // 获取硬盘身份信息
 #define CMD_READ_SECTOR  0x20   // 读扇区
 #define CMD_WRITE_SECTOR 0x30   // 写扇区
+#define CMD_READ_MULTIPLE  0xc4 // 读多个扇区，每次中断传输 multi_secs 个扇区
+#define CMD_WRITE_MULTIPLE 0xc5 // 写多个扇区
+#define CMD_SET_MULTIPLE   0xc6 // 设置 READ/WRITE MULTIPLE 每次传输的扇区数
 
 // 最大的lba地址，用于调试避免扇区地址越界
 #define max_lba ((80 * 1024 * 1024 / 512) - 1)
@@ -127,88 +133,186 @@ static void write_to_sector(struct disk* hd, void* buf, uint8_t sector_cnt) {
 // 等代硬盘30秒，判断硬盘的状态
 static bool busy_wait(struct disk* hd) {
     struct ide_channel* channel = hd->my_channel;
-    uint16_t time_limit = 30 * 1000;
-    while (time_limit -= 10 >= 0) {
+    int32_t time_limit = 30 * 1000;
+    while (time_limit >= 0) {
         if(!(inb(reg_status(channel)) & BIT_STAT_BSY)) return(inb(reg_status(channel)) & BIT_STAT_DRQ);
         else mtime_sleep(10); // status寄存器的BSY位为1，硬盘繁忙
+        time_limit -= 10;
     }
     return false;
 }
 
-// 从硬盘中读取sec_cnt个扇区到buf
-void ide_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
-    ASSERT(lba <= max_lba);
-    ASSERT(sec_cnt > 0);
-
-    lock_acquire(&hd->my_channel->lock);
-
-    select_disk(hd);     // 选择操作的硬盘
-
-    uint32_t secs_op;    // 一次读写的扇区数
-    uint32_t secs_done = 0;  // 已读写的扇区数
-    while (secs_done < sec_cnt) { 
-        //计算本次读写的扇区数，读写扇区数端口是8位寄存器
-        if ((secs_done + 256) <= sec_cnt) secs_op = 256;
-        else secs_op = sec_cnt - secs_done;
-
-        select_sector(hd, lba + secs_done, secs_op); // 写入起始扇区地址及要读写的扇区数
-
-        cmd_out(hd->my_channel, CMD_READ_SECTOR);  // 向reg_cmd寄存器发出写命令
+// 轮询等待硬盘可以接收写数据，用于发出写命令之后，可能在中断处理程序中调用所以不能睡眠
+static bool drq_wait(struct ide_channel* channel) {
+    uint32_t spin = 1000000;
+    uint8_t status;
+    while (spin--) {
+        status = inb(reg_alt_status(channel));
+        if (status & BIT_STAT_BSY) continue;
+        if (status & BIT_STAT_ERR) return false;
+        if (status & BIT_STAT_DRQ) return true;
+    }
+    return false;
+}
 
-        sema_down(&hd->my_channel->disk_done);     // 将驱动程序阻塞
+// 请求出错时直接停机，与原来的同步读写保持一致
+static void bio_error(struct bio* bio) {
+    char error[64];
+    sprintf(error, "%s %s sector %d failed!!!!!!\n", bio->hd->name, \
+            bio->rw == BIO_READ ? "read" : "write", bio->lba + bio->secs_done);
+    PANIC(error);
+}
 
-        if (!busy_wait(hd)) { // 读失败
-            char error[64];
-            sprintf(error, "%s read sector %d failed!!!!!!\n", hd->name, lba);
-            PANIC(error);
+// 在当前请求的缓冲区和硬盘之间传输secs个扇区，合并的请求由多个 bio 首尾相接组成
+static void bio_transfer(struct ide_channel* channel, uint32_t secs) {
+    channel->cmd_done += secs;
+
+    while (secs > 0) {
+        struct bio* bio = channel->xfer_bio;
+        uint32_t secs_op = bio->sec_cnt - channel->xfer_off;
+        if (secs_op > secs) secs_op = secs;
+        void* buf = (void*)((uint32_t)bio->buf + channel->xfer_off * 512);
+
+        if (bio->rw == BIO_READ) read_from_sector(bio->hd, buf, secs_op);
+        else write_to_sector(bio->hd, buf, secs_op);
+
+        bio->secs_done += secs_op;
+        channel->xfer_off += secs_op;
+        secs -= secs_op;
+        if (channel->xfer_off == bio->sec_cnt) { // 这个 bio 传完了，转到合并请求中的下一个
+            channel->xfer_bio = bio->merge_next;
+            channel->xfer_off = 0;
         }
-
-        read_from_sector(hd, (void*)((uint32_t)buf + secs_done * 512), secs_op);    // 将扇区数据读入到缓冲区
-        secs_done += secs_op;
     }
-
-    lock_release(&hd->my_channel->lock);
-
 }
 
-// 将buf中的sec_cnt个扇区写到硬盘
-void ide_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
-   
-    // printk("%d\n", lba);
-    ASSERT(lba <= max_lba);
-    ASSERT(sec_cnt > 0);
+// 本次中断要传输的扇区数，支持 MULTIPLE 命令时一次传一块
+static uint32_t bio_block_secs(struct ide_channel* channel) {
+    uint32_t block = channel->cur_bio->hd->multi_secs;
+    if (block == 0) block = 1;
+    uint32_t left = channel->cmd_secs - channel->cmd_done;
+    return left < block ? left : block;
+}
 
-    lock_acquire(&hd->my_channel->lock);
+// 为当前请求发出下一条命令，一条命令最多 256 个扇区
+static void ide_start_cmd(struct ide_channel* channel) {
+    struct bio* req = channel->cur_bio;
+    struct disk* hd = req->hd;
+    uint32_t secs_left = req->req_secs - channel->req_done;
+    channel->cmd_secs = secs_left > 256 ? 256 : secs_left;
+    channel->cmd_done = 0;
 
     select_disk(hd);
+    select_sector(hd, req->lba + channel->req_done, channel->cmd_secs); // 256 截断为 0，硬盘按 256 处理
 
-    uint32_t secs_op, secs_done = 0;
+    uint8_t cmd;
+    if (req->rw == BIO_READ) cmd = hd->multi_secs ? CMD_READ_MULTIPLE : CMD_READ_SECTOR;
+    else cmd = hd->multi_secs ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR;
+    cmd_out(channel, cmd);
 
-    while (secs_done < sec_cnt) {
-        if ((secs_done + 256) <= sec_cnt) secs_op = 256;
-        else secs_op = sec_cnt - secs_done;
+    // 写命令要先送出第一块数据，之后每写完一块硬盘会发一次中断
+    if (req->rw == BIO_WRITE) {
+        if (!drq_wait(channel)) bio_error(req);
+        bio_transfer(channel, bio_block_secs(channel));
+    }
+}
 
-        select_sector(hd, lba + secs_done, secs_op);
-        cmd_out(hd->my_channel, CMD_WRITE_SECTOR);
+// 由电梯选出下一个请求并开始执行，须在关中断下调用
+static void ide_start_next(struct ide_channel* channel) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    if (channel->cur_bio != NULL || channel->plugged) return;
+
+    struct bio* req = elv_next_request(channel);
+    if (req == NULL) return;
+    channel->cur_bio = req;
+    channel->req_done = 0;
+    channel->xfer_bio = req;
+    channel->xfer_off = 0;
+    ide_start_cmd(channel);
+}
 
-        if(!busy_wait(hd)) {
-            char error[64];
-            sprintf(error, "%s write sector %d failed!!!!!!\n", hd->name, lba);
-            PANIC(error);
-        }
+// 当前请求全部完成，逐个通知合并在其中的 bio 的提交者，并开始下一个请求
+static void bio_complete(struct ide_channel* channel) {
+    struct bio* bio = channel->cur_bio;
+    channel->cur_bio = NULL;
 
-        write_to_sector(hd, (void*)((uint32_t)buf + secs_done * 512), secs_op);
+    while (bio != NULL) {
+        struct bio* next = bio->merge_next; // 回调之后 bio 可能已被提交者释放
+        if (bio->end_io != NULL) bio->end_io(bio);
+        else sema_up(&bio->done);
+        bio = next;
+    }
 
-        sema_down(&hd->my_channel->disk_done);
+    ide_start_next(channel);
+}
 
-        secs_done += secs_op;
-    }
+/* 初始化请求描述符，默认完成时唤醒 done，需要回调的调用者再设置 end_io。
+ * 缓冲区在中断中读写，此时运行的可能是别的进程，所以buf必须在内核空间 */
+void bio_init(struct bio* bio, struct disk* hd, uint8_t rw, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    ASSERT(lba + sec_cnt - 1 <= max_lba);
+    ASSERT(sec_cnt > 0);
+    ASSERT((uint32_t)buf >= 0xc0000000);
+    bio->hd = hd;
+    bio->rw = rw;
+    bio->lba = lba;
+    bio->buf = buf;
+    bio->sec_cnt = sec_cnt;
+    bio->secs_done = 0;
+    bio->end_io = NULL;
+    bio->private = NULL;
+    sema_init(&bio->done, 0);
+    bio->queue_tag.prev = bio->queue_tag.next = NULL;
+    bio->merge_next = NULL;
+    bio->req_secs = sec_cnt;
+}
+
+// 提交请求，不阻塞，通道空闲时立即开始执行
+void ide_submit(struct bio* bio) {
+    struct ide_channel* channel = bio->hd->my_channel;
+    enum intr_status old_status = intr_disable();
+    elv_add_bio(channel, bio);
+    ide_start_next(channel);
+    intr_set_status(old_status);
+}
 
-    lock_release(&hd->my_channel->lock);
+// 暂停下发，之后提交的一批请求先在队列中排序合并，plug 和 unplug 之间不能等待请求完成
+void ide_plug(struct disk* hd) {
+    enum intr_status old_status = intr_disable();
+    hd->my_channel->plugged++;
+    intr_set_status(old_status);
+}
 
+// 恢复下发
+void ide_unplug(struct disk* hd) {
+    struct ide_channel* channel = hd->my_channel;
+    enum intr_status old_status = intr_disable();
+    ASSERT(channel->plugged > 0);
+    channel->plugged--;
+    ide_start_next(channel);
+    intr_set_status(old_status);
 }
 
+// 等待没有设置完成回调的请求完成
+void bio_wait(struct bio* bio) {
+    ASSERT(bio->end_io == NULL);
+    sema_down(&bio->done);
+}
 
+// 从硬盘中读取sec_cnt个扇区到buf
+void ide_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    struct bio bio;
+    bio_init(&bio, hd, BIO_READ, lba, buf, sec_cnt);
+    ide_submit(&bio);
+    bio_wait(&bio);
+}
+
+// 将buf中的sec_cnt个扇区写到硬盘
+void ide_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    struct bio bio;
+    bio_init(&bio, hd, BIO_WRITE, lba, buf, sec_cnt);
+    ide_submit(&bio);
+    bio_wait(&bio);
+}
 
 // 将dst中len个相邻字节交换位置后存入buf
 static void swap_pairs_bytes(const char* dst, char* buf, uint32_t len) {
@@ -249,7 +353,18 @@ static void identify_disk(struct disk* hd) {
     uint32_t sectors = *(uint32_t*)&id_info[60 * 2];
     printk("    SECTORS: %d\n", sectors);
     printk("    CAPACITY: %dMB\n", sectors * 512 / 1024/ 1024);
-    
+
+    // 第47字的低字节是 READ/WRITE MULTIPLE 每块最多的扇区数，为0表示不支持
+    uint8_t multi_max = id_info[47 * 2];
+    hd->multi_secs = 0;
+    if (multi_max != 0) {
+        select_disk(hd);
+        outb(reg_sect_cnt(hd->my_channel), multi_max);
+        cmd_out(hd->my_channel, CMD_SET_MULTIPLE);
+        sema_down(&hd->my_channel->disk_done);
+        if (!(inb(reg_status(hd->my_channel)) & BIT_STAT_ERR)) hd->multi_secs = multi_max;
+    }
+    printk("    MULTIPLE: %d\n", hd->multi_secs);
 }
 
 
@@ -305,6 +420,12 @@ static bool partition_info(struct list_elem* pelem, int arg UNUSED) {
     return false;
 }
 
+// 打印每个通道的调度统计信息，供 iostat 命令使用
+void sys_iostat(void) {
+    uint8_t channel_no = 0;
+    while (channel_no < channel_cnt) elv_print_stat(&channels[channel_no++]);
+}
+
 // 硬盘中断处理程序，负责两个通道的中断
 void intr_hd_handler(uint8_t irq_no) {
     ASSERT(irq_no == 0x2e || irq_no == 0x2f);
@@ -313,12 +434,33 @@ void intr_hd_handler(uint8_t irq_no) {
     ASSERT(channel->irq_no == irq_no);
 
     // 如果通道发生了中断信号，只会有最近一次的硬盘操作引起
-    if (channel->expecting_intr) {
-        channel->expecting_intr = false;
-        sema_up(&channel->disk_done); // 唤醒阻塞在此信号量上的驱动程序
+    if (!channel->expecting_intr) return; // 错误情况暂不处理
 
+    struct bio* bio = channel->cur_bio;
+    if (bio == NULL) { // 不经过请求队列的命令，唤醒阻塞在此信号量上的驱动程序
+        channel->expecting_intr = false;
+        sema_up(&channel->disk_done);
         inb(reg_status(channel));     // 中断处理完成，显式通知硬盘控制器
-    } // 错误情况暂不处理
+        return;
+    }
+
+    uint8_t status = inb(reg_status(channel)); // 读状态寄存器同时应答中断
+    if (status & BIT_STAT_ERR) bio_error(bio);
+
+    if (bio->rw == BIO_READ) { // 读命令每次中断表示一块数据已就绪
+        if (!(status & BIT_STAT_DRQ)) bio_error(bio);
+        bio_transfer(channel, bio_block_secs(channel));
+    } else if (channel->cmd_done < channel->cmd_secs) { // 写命令上一块已写完，送出下一块
+        bio_transfer(channel, bio_block_secs(channel));
+        return;
+    }
+
+    if (channel->cmd_done < channel->cmd_secs) return; // 本条命令还有数据没传完
+
+    channel->expecting_intr = false;
+    channel->req_done += channel->cmd_secs;
+    if (channel->req_done < bio->req_secs) ide_start_cmd(channel); // 超过256个扇区的请求继续发下一条命令
+    else bio_complete(channel);
 }
 
 
@@ -352,6 +494,12 @@ void ide_init() {
         channel->expecting_intr = false;
         lock_init(&channel->lock);
         sema_init(&channel->disk_done, 0);
+        list_init(&channel->bio_queue);
+        channel->cur_bio = NULL;
+        channel->plugged = 0;
+        channel->head_key = 0;
+        channel->queue_depth = channel->max_depth = channel->depth_sum = 0;
+        channel->dispatch_cnt = channel->merge_cnt = 0;
 
         register_handler(channel->irq_no, intr_hd_handler);
 
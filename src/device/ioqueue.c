@@ -4,20 +4,31 @@
 #include <kernel/interrupt.h>
 #include <kernel/debug.h>
 #include <kernel/thread.h>
+#include <kernel/string.h>
 
 void ioqueue_init(struct ioqueue* ioq) {
     lock_init(&ioq->lock);
     ioq->producer = ioq->consumer = NULL;
+    ioq->buf = ioq->data;
+    ioq->size = bufsize;
     ioq->head = ioq->tail = 0;
 }
 
-static uint32_t next_pos(uint32_t pos) {
-    return (pos + 1) % bufsize;
+// 换用调用者提供的缓冲区，只能在缓冲区为空且没有线程等待时调用
+void ioqueue_set_buf(struct ioqueue* ioq, char* buf, uint32_t size) {
+    ASSERT(ioq->head == ioq->tail && ioq->producer == NULL && ioq->consumer == NULL);
+    ioq->buf = buf;
+    ioq->size = size;
+    ioq->head = ioq->tail = 0;
+}
+
+static uint32_t next_pos(struct ioqueue* ioq, uint32_t pos) {
+    return (pos + 1) % ioq->size;
 }
 
 bool ioq_full(struct ioqueue* ioq) {
     ASSERT(intr_get_status() == INTR_OFF);
-    return (next_pos(ioq->head) == ioq->tail);
+    return (next_pos(ioq, ioq->head) == ioq->tail);
 }
 
 bool ioq_empty(struct ioqueue* ioq) {
@@ -26,13 +37,13 @@ bool ioq_empty(struct ioqueue* ioq) {
 }
 
 //使生产者或者消费者在该缓冲区上等待，传入的参数是线程指针的地址
-static void ioq_wait(struct task_struct** waiter) {
+void ioq_wait(struct task_struct** waiter) {
     ASSERT(*waiter == NULL && waiter != NULL);
     *waiter = running_thread(); //将当前线程记录在缓冲区的 producer 或者 consumer 中
     thread_block(TASK_BLOCKED);
 }
 
-static void wakeup (struct task_struct** waiter) {
+void ioq_wakeup(struct task_struct** waiter) {
     ASSERT(*waiter != NULL);
     thread_unblock(*waiter);
     *waiter = NULL;
@@ -52,11 +63,11 @@ char ioq_get_char(struct ioqueue* ioq) {
     }
 
     char ch = ioq->buf[ioq->tail];
-    ioq->tail = next_pos(ioq->tail);
+    ioq->tail = next_pos(ioq, ioq->tail);
     
     //唤醒生产者
     if (ioq->producer != NULL) {
-        wakeup(&ioq->producer);
+        ioq_wakeup(&ioq->producer);
     }
 
     return ch;
@@ -74,11 +85,11 @@ void ioq_put_char(struct ioqueue* ioq, char ch) {
     }
 
     ioq->buf[ioq->head] = ch;
-    ioq->head = next_pos(ioq->head);
+    ioq->head = next_pos(ioq, ioq->head);
 
     //唤醒消费者
     if (ioq->consumer != NULL) {
-        wakeup(&ioq->consumer);
+        ioq_wakeup(&ioq->consumer);
     }
 
 }
@@ -89,7 +100,78 @@ uint32_t ioq_length(struct ioqueue* ioq) {
     if (ioq->head >= ioq->tail) {
         len = ioq->head - ioq->tail;
     } else {
-        len = bufsize - (ioq->tail - ioq->head);
+        len = ioq->size - (ioq->tail - ioq->head);
     }
     return len;
+}
+
+/* 消费者从缓冲区中取出最多 cnt 个字节到 buf，不阻塞，返回取出的字节数
+ * 按环形缓冲区中连续的段整段拷贝，取完后只唤醒一次生产者 */
+uint32_t ioq_read_bulk(struct ioqueue* ioq, void* buf, uint32_t cnt) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    char* dst = buf;
+    uint32_t bytes_read = 0, span = 0;
+
+    while (bytes_read < cnt && !ioq_empty(ioq)) {
+        // 从 tail 开始连续可读到 head 或者缓冲区末尾
+        if (ioq->head > ioq->tail) {
+            span = ioq->head - ioq->tail;
+        } else {
+            span = ioq->size - ioq->tail;
+        }
+        if (span > cnt - bytes_read) span = cnt - bytes_read;
+        memcpy(dst + bytes_read, ioq->buf + ioq->tail, span);
+        ioq->tail = (ioq->tail + span) % ioq->size;
+        bytes_read += span;
+    }
+
+    if (bytes_read != 0 && ioq->producer != NULL) {
+        ioq_wakeup(&ioq->producer);
+    }
+    return bytes_read;
+}
+
+// 返回从 tail 开始连续可读的字节数，*data 指向这段数据，数据在 ioq_consume 之前不会被覆盖
+uint32_t ioq_peek(struct ioqueue* ioq, char** data) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    *data = ioq->buf + ioq->tail;
+    if (ioq->head >= ioq->tail) return ioq->head - ioq->tail;
+    return ioq->size - ioq->tail;
+}
+
+// 丢弃 ioq_peek 得到的数据的前 len 个字节，唤醒生产者
+void ioq_consume(struct ioqueue* ioq, uint32_t len) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    ASSERT(len <= ioq_length(ioq));
+    if (len == 0) return;
+    ioq->tail = (ioq->tail + len) % ioq->size;
+    if (ioq->producer != NULL) {
+        ioq_wakeup(&ioq->producer);
+    }
+}
+
+/* 生产者把 buf 中最多 cnt 个字节放入缓冲区，不阻塞，返回放入的字节数
+ * 按环形缓冲区中连续的空闲段整段拷贝，放完后只唤醒一次消费者 */
+uint32_t ioq_write_bulk(struct ioqueue* ioq, const void* buf, uint32_t cnt) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    const char* src = buf;
+    uint32_t bytes_write = 0, span = 0;
+
+    while (bytes_write < cnt && !ioq_full(ioq)) {
+        // 从 head 开始连续可写到 tail 的前一个位置或者缓冲区末尾
+        if (ioq->head >= ioq->tail) {
+            span = ioq->size - ioq->head - (ioq->tail == 0 ? 1 : 0);
+        } else {
+            span = ioq->tail - ioq->head - 1;
+        }
+        if (span > cnt - bytes_write) span = cnt - bytes_write;
+        memcpy(ioq->buf + ioq->head, src + bytes_write, span);
+        ioq->head = (ioq->head + span) % ioq->size;
+        bytes_write += span;
+    }
+
+    if (bytes_write != 0 && ioq->consumer != NULL) {
+        ioq_wakeup(&ioq->consumer);
+    }
+    return bytes_write;
 }
\ No newline at end of file
@@ -5,6 +5,8 @@
 #include<kernel/interrupt.h>
 #include <kernel/debug.h>
 #include <kernel/global.h>
+#include <kernel/list.h>
+#include <user/vdso-init.h>
 
 #define IRQ0_FREQUENCY 100
 #define INPUT_FREQUENCY 1193180
@@ -19,6 +21,11 @@
 
 uint32_t ticks;//内核自中断开启以来总共的嘀嗒数
 
+// 睡眠队列，用散列定时轮实现：到期 ticks 为 t 的线程挂在 t % TIMER_WHEEL_SLOTS 槽上，
+// 每个嘀嗒只需检查一个槽，槽中未到期的线程要等下一轮
+#define TIMER_WHEEL_SLOTS 64
+static struct list timer_wheel[TIMER_WHEEL_SLOTS];
+
 static void frequency_set(uint8_t counter_port,
                           uint8_t counter_no,
                           uint8_t rwl,
@@ -44,6 +51,40 @@ static void frequency_set(uint8_t counter_port,
 
     //while (1);
 }
+// 将pthread挂到定时轮上，到 wakeup_tick 时由时钟中断唤醒，须在关中断下调用
+void timer_add_sleeper(struct task_struct* pthread, uint32_t wakeup_tick) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    pthread->wakeup_tick = wakeup_tick;
+    list_append(&timer_wheel[wakeup_tick % TIMER_WHEEL_SLOTS], &pthread->sleep_tag);
+}
+
+// 将pthread从定时轮上取下，用于限时等待提前被唤醒的情况，须在关中断下调用
+void timer_del_sleeper(struct task_struct* pthread) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    list_remove(&pthread->sleep_tag);
+}
+
+// 唤醒当前槽中到期的线程
+static void timer_wheel_expire(void) {
+    struct list* slot = &timer_wheel[ticks % TIMER_WHEEL_SLOTS];
+    struct list_elem* elem = slot->head.next;
+    while (elem != &slot->tail) {
+        struct list_elem* next = elem->next;
+        struct task_struct* pthread = elem2entry(struct task_struct, sleep_tag, elem);
+        // 用差值比较，ticks 回绕后也能正确判断
+        if ((int32_t)(ticks - pthread->wakeup_tick) >= 0) {
+            list_remove(elem);
+            if (pthread->sleep_sema != NULL) { // 限时等待超时，从信号量的等待队列中摘下
+                list_remove(&pthread->general_tag);
+                pthread->sleep_sema = NULL;
+                pthread->timed_out = true;
+            }
+            thread_unblock(pthread);
+        }
+        elem = next;
+    }
+}
+
 //时钟中断处理函数
 static void intr_timer_handler(void) {
     struct task_struct* cur_thread = running_thread();
@@ -52,23 +93,30 @@ static void intr_timer_handler(void) {
     cur_thread->elapsed_ticks++;
 
     ticks++;
+    vdso_tick(cur_thread);
+    timer_wheel_expire();
 
-    if (cur_thread->ticks == 0) schedule();
+    // 时间片用完，或多级反馈队列中有更高级别的任务就绪时，进行调度
+    if (cur_thread->ticks == 0 || sched_need_preempt(cur_thread)) schedule();
     else cur_thread->ticks--;
 }
 
-// 以时钟嘀嗒数为单位进行休眠
+// 以时钟嘀嗒数为单位进行休眠，线程阻塞在定时轮上，不再占用就绪队列
 static void ticks_to_sleep(uint32_t sleep_ticks) {
-    uint32_t start_tick = ticks;
-    while (ticks - start_tick < sleep_ticks)
-    {
-        thread_yield();
-    }
+    enum intr_status old_status = intr_disable();
+    timer_add_sleeper(running_thread(), ticks + sleep_ticks);
+    thread_block(TASK_BLOCKED);
+    intr_set_status(old_status);
+}
+
+// 将毫秒换算成嘀嗒数，不足一个嘀嗒按一个算
+uint32_t mtime_to_ticks(uint32_t m_seconds) {
+    return DIV_ROUND_UP(m_seconds, mil_seconds_per_intr);
 }
 
 // 以毫秒为单位休眠
 void mtime_sleep(uint32_t m_seconds) {
-    uint32_t sleep_ticks = DIV_ROUND_UP(m_seconds, mil_seconds_per_intr);
+    uint32_t sleep_ticks = mtime_to_ticks(m_seconds);
     ASSERT(sleep_ticks > 0);
     ticks_to_sleep(sleep_ticks);
 }
@@ -79,6 +127,11 @@ void mtime_sleep(uint32_t m_seconds) {
 void timer_init() {
     put_str("timer_init start.\n");
     ticks = 0;
+    uint32_t slot = 0;
+    while (slot < TIMER_WHEEL_SLOTS) {
+        list_init(&timer_wheel[slot]);
+        slot++;
+    }
     frequency_set(COUNTER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, COUNTER_MODE, COUNTER0_VALUE);
     //注册时钟中断函数
     register_handler(0x20, intr_timer_handler);
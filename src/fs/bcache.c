@@ -0,0 +1,375 @@
+#include <fs/bcache.h>
+#include <device/ide.h>
+#include <device/timer.h>
+#include <kernel/list.h>
+#include <kernel/debug.h>
+#include <kernel/global.h>
+#include <kernel/memory.h>
+#include <kernel/string.h>
+#include <kernel/thread.h>
+#include <kernel/interrupt.h>
+#include <lib/kernel/stdio-kernel.h>
+
+/**
+ * 块缓存.
+ * 以 (硬盘, 扇区地址) 为键缓存扇区，散列表查找，未被引用的缓冲区按使用先后排在 LRU 队列中，
+ * 写操作只修改缓冲区并标记为脏，由刷回线程定期、或在关闭文件时批量写回磁盘。
+ * 散列表和 LRU 队列只在关中断下修改，磁盘读写期间用 BH_LOCKED 标记缓冲区，不持有全局的锁。
+ */
+
+static struct buffer_head* bh_table;            // 所有的缓冲区头
+static struct list bh_hash[BCACHE_HASH_SIZE];   // 散列表
+static struct list bh_lru;                      // 队首是最近使用的，从队尾换出
+
+static uint32_t bh_hashfn(struct disk* hd, uint32_t lba) {
+    return (lba ^ ((uint32_t)hd >> 4)) % BCACHE_HASH_SIZE;
+}
+
+// 在散列表中查找缓冲区，须在关中断下调用
+static struct buffer_head* bh_lookup(struct disk* hd, uint32_t lba) {
+    struct list* bucket = &bh_hash[bh_hashfn(hd, lba)];
+    struct list_elem* elem = bucket->head.next;
+    while (elem != &bucket->tail) {
+        struct buffer_head* bh = elem2entry(struct buffer_head, hash_tag, elem);
+        if (bh->hd == hd && bh->lba == lba) return bh;
+        elem = elem->next;
+    }
+    return NULL;
+}
+
+// 等待缓冲区上的磁盘读写完成
+static void wait_on_buffer(struct buffer_head* bh) {
+    enum intr_status old_status = intr_disable();
+    while (bh->flags & BH_LOCKED) {
+        list_append(&bh->waiters, &running_thread()->general_tag);
+        thread_block(TASK_BLOCKED);
+    }
+    intr_set_status(old_status);
+}
+
+// 清除缓冲区的 BH_LOCKED 并唤醒等待它的线程，须在关中断下调用
+static void bh_unlock(struct buffer_head* bh) {
+    bh->flags &= ~BH_LOCKED;
+    while (!list_empty(&bh->waiters)) {
+        struct task_struct* waiter = elem2entry(struct task_struct, general_tag, list_pop(&bh->waiters));
+        thread_unblock(waiter);
+    }
+}
+
+// 缓冲区读写完成的回调，在硬盘中断中执行
+static void bh_end_io(struct bio* bio) {
+    struct buffer_head* bh = bio->private;
+    if (bio->rw == BIO_READ) bh->flags |= BH_VALID;
+    bh_unlock(bh);
+}
+
+// 为缓冲区发起异步读写，须在关中断下调用且已置 BH_LOCKED
+static void bh_submit(struct buffer_head* bh, uint8_t rw) {
+    ASSERT(bh->flags & BH_LOCKED);
+    bio_init(&bh->bio, bh->hd, rw, bh->lba, bh->data, 1);
+    bh->bio.end_io = bh_end_io;
+    bh->bio.private = bh;
+    ide_submit(&bh->bio);
+}
+
+/* 把 hd 上所有未被引用的脏缓冲区提交写回，hd 为NULL表示所有硬盘，
+ * 同一批请求先由电梯排序合并再下发。wait 为 true 时等待所有正在读写的缓冲区完成，
+ * 返回提交或等待的缓冲区数 */
+static uint32_t bcache_writeback(struct disk* hd, bool wait) {
+    uint8_t submitted[BCACHE_NR_BUFFERS / 8] = {0};
+    uint32_t cnt = 0;
+    uint32_t idx = 0;
+
+    enum intr_status old_status = intr_disable();
+    while (idx < BCACHE_NR_BUFFERS) {
+        struct buffer_head* bh = &bh_table[idx];
+        if ((hd == NULL || bh->hd == hd) && bh->pin_cnt == 0 && \
+            (bh->flags & (BH_DIRTY | BH_LOCKED)) == BH_DIRTY) {
+            bh->flags = (bh->flags & ~BH_DIRTY) | BH_LOCKED;
+            ide_plug(bh->hd);
+            bh_submit(bh, BIO_WRITE);
+            submitted[idx / 8] |= 1 << (idx % 8);
+            cnt++;
+        }
+        idx++;
+    }
+    for (idx = 0; idx < BCACHE_NR_BUFFERS; idx++) {
+        if (submitted[idx / 8] & (1 << (idx % 8))) ide_unplug(bh_table[idx].hd);
+    }
+    intr_set_status(old_status);
+
+    if (!wait) return cnt;
+
+    cnt = 0;
+    for (idx = 0; idx < BCACHE_NR_BUFFERS; idx++) {
+        struct buffer_head* bh = &bh_table[idx];
+        if ((hd == NULL || bh->hd == hd) && (bh->flags & BH_LOCKED)) {
+            wait_on_buffer(bh);
+            cnt++;
+        }
+    }
+    return cnt;
+}
+
+// 获取 (hd, lba) 对应的缓冲区并增加引用，不读磁盘，缓存中没有时换出最久未使用的干净缓冲区
+static struct buffer_head* getblk(struct disk* hd, uint32_t lba) {
+    while (1) {
+        enum intr_status old_status = intr_disable();
+        struct buffer_head* bh = bh_lookup(hd, lba);
+        if (bh != NULL) {
+            if (bh->pin_cnt++ == 0) list_remove(&bh->lru_tag);
+            intr_set_status(old_status);
+            return bh;
+        }
+
+        struct list_elem* elem = bh_lru.tail.prev;
+        while (elem != &bh_lru.head) {
+            bh = elem2entry(struct buffer_head, lru_tag, elem);
+            if (!(bh->flags & (BH_DIRTY | BH_LOCKED))) break;
+            elem = elem->prev;
+        }
+
+        if (elem != &bh_lru.head) {
+            list_remove(&bh->lru_tag);
+            list_remove(&bh->hash_tag);
+            bh->hd = hd;
+            bh->lba = lba;
+            bh->flags = 0;
+            bh->pin_cnt = 1;
+            list_append(&bh_hash[bh_hashfn(hd, lba)], &bh->hash_tag);
+            intr_set_status(old_status);
+            return bh;
+        }
+        intr_set_status(old_status);
+
+        // 没有干净的空闲缓冲区，先把脏缓冲区写回再重试
+        if (bcache_writeback(NULL, true) == 0) PANIC("getblk: all buffers are pinned");
+    }
+}
+
+// 读取一个扇区的缓冲区，用完后须调用 brelse
+struct buffer_head* bread(struct disk* hd, uint32_t lba) {
+    struct buffer_head* bh = getblk(hd, lba);
+    enum intr_status old_status = intr_disable();
+    if (!(bh->flags & (BH_VALID | BH_LOCKED))) {
+        bh->flags |= BH_LOCKED;
+        bh_submit(bh, BIO_READ);
+    }
+    intr_set_status(old_status);
+    wait_on_buffer(bh);
+    return bh;
+}
+
+// 释放对缓冲区的引用，不再被引用的缓冲区排到 LRU 队首
+void brelse(struct buffer_head* bh) {
+    enum intr_status old_status = intr_disable();
+    ASSERT(bh->pin_cnt > 0);
+    if (--bh->pin_cnt == 0) list_push(&bh_lru, &bh->lru_tag);
+    intr_set_status(old_status);
+}
+
+// 获取一个将被整体覆盖的扇区的缓冲区，不读磁盘，数据清零并标记为脏，用完后须调用 brelse
+struct buffer_head* bnew(struct disk* hd, uint32_t lba) {
+    struct buffer_head* bh = getblk(hd, lba);
+    enum intr_status old_status = intr_disable();
+    wait_on_buffer(bh);
+    memset(bh->data, 0, 512);
+    bh->flags |= BH_VALID | BH_DIRTY;
+    intr_set_status(old_status);
+    return bh;
+}
+
+// 调用者修改了引用中的缓冲区数据后，标记其需要写回
+void bmark_dirty(struct buffer_head* bh) {
+    ASSERT(bh->pin_cnt > 0 && (bh->flags & BH_VALID));
+    bh->flags |= BH_DIRTY;
+}
+
+// 异步预读从lba开始的cnt个扇区，不等待完成，相邻扇区由电梯合并成一条命令
+void bcache_prefetch(struct disk* hd, uint32_t lba, uint32_t cnt) {
+    struct buffer_head* bhs[BCACHE_BATCH];
+    uint32_t secs_done = 0;
+    while (secs_done < cnt) {
+        uint32_t batch = cnt - secs_done;
+        if (batch > BCACHE_BATCH) batch = BCACHE_BATCH;
+
+        // getblk 可能要等待写回，所以先取齐缓冲区再 plug
+        uint32_t idx = 0;
+        while (idx < batch) {
+            bhs[idx] = getblk(hd, lba + secs_done + idx);
+            idx++;
+        }
+
+        enum intr_status old_status = intr_disable();
+        ide_plug(hd);
+        for (idx = 0; idx < batch; idx++) {
+            if (!(bhs[idx]->flags & (BH_VALID | BH_LOCKED))) {
+                bhs[idx]->flags |= BH_LOCKED;
+                bh_submit(bhs[idx], BIO_READ);
+            }
+            // 读的过程中缓冲区带着 BH_LOCKED，不会被换出
+            brelse(bhs[idx]);
+        }
+        ide_unplug(hd);
+        intr_set_status(old_status);
+        secs_done += batch;
+    }
+}
+
+// 经缓存从硬盘读取sec_cnt个扇区到buf，一批中不在缓存里的扇区一起提交，相邻的由电梯合并
+void bcache_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    struct buffer_head* bhs[BCACHE_BATCH];
+    uint32_t secs_done = 0;
+    while (secs_done < sec_cnt) {
+        uint32_t batch = sec_cnt - secs_done;
+        if (batch > BCACHE_BATCH) batch = BCACHE_BATCH;
+
+        uint32_t idx = 0;
+        while (idx < batch) {
+            bhs[idx] = getblk(hd, lba + secs_done + idx);
+            idx++;
+        }
+
+        enum intr_status old_status = intr_disable();
+        ide_plug(hd);
+        for (idx = 0; idx < batch; idx++) {
+            if (!(bhs[idx]->flags & (BH_VALID | BH_LOCKED))) {
+                bhs[idx]->flags |= BH_LOCKED;
+                bh_submit(bhs[idx], BIO_READ);
+            }
+        }
+        ide_unplug(hd);
+        intr_set_status(old_status);
+
+        for (idx = 0; idx < batch; idx++) {
+            wait_on_buffer(bhs[idx]);
+            memcpy((uint8_t*)buf + (secs_done + idx) * 512, bhs[idx]->data, 512);
+            brelse(bhs[idx]);
+        }
+        secs_done += batch;
+    }
+}
+
+// 经缓存将buf中的sec_cnt个扇区写到硬盘，整扇区覆盖不需要先读，之后由刷回线程写回
+void bcache_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    uint32_t idx = 0;
+    while (idx < sec_cnt) {
+        // buf可能是按需调页还没调入的用户页，调入要读盘睡眠，先在下面的临界区之外访问一次
+        volatile uint8_t* src = (volatile uint8_t*)buf + idx * 512;
+        (void)src[0];
+        (void)src[511];
+        struct buffer_head* bh = getblk(hd, lba + idx);
+        // 关中断保证等到缓冲区空闲后，复制完数据前不会有新的读请求覆盖它
+        enum intr_status old_status = intr_disable();
+        wait_on_buffer(bh);
+        memcpy(bh->data, (uint8_t*)buf + idx * 512, 512);
+        bh->flags |= BH_VALID | BH_DIRTY;
+        intr_set_status(old_status);
+        brelse(bh);
+        idx++;
+    }
+}
+
+/* 不经过缓冲区，直接把buf中的sec_cnt个扇区写到硬盘并等待完成，用于大段的整扇区写。
+ * 写盘期间这些扇区的缓冲区都带着 BH_LOCKED，并发的读只会等待，不会先于写把旧数据读进缓存；
+ * 写完后缓冲区同步成新数据并清除脏标记，免得之后被旧数据覆盖或重复写回。
+ * 硬盘在中断中读取buf，所以buf必须在内核空间 */
+void bcache_write_direct(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    struct buffer_head* bhs[BCACHE_BATCH];
+    uint32_t secs_done = 0;
+    while (secs_done < sec_cnt) {
+        uint32_t batch = sec_cnt - secs_done;
+        if (batch > BCACHE_BATCH) batch = BCACHE_BATCH;
+
+        uint32_t idx = 0;
+        while (idx < batch) {
+            bhs[idx] = getblk(hd, lba + secs_done + idx);
+            idx++;
+        }
+
+        // 按扇区地址从小到大加锁，两个重叠的直接写不会互相等待
+        enum intr_status old_status = intr_disable();
+        for (idx = 0; idx < batch; idx++) {
+            wait_on_buffer(bhs[idx]);
+            bhs[idx]->flags = (bhs[idx]->flags | BH_LOCKED) & ~BH_DIRTY;
+        }
+        intr_set_status(old_status);
+
+        ide_write(hd, lba + secs_done, (uint8_t*)buf + secs_done * 512, batch);
+
+        old_status = intr_disable();
+        for (idx = 0; idx < batch; idx++) {
+            memcpy(bhs[idx]->data, (uint8_t*)buf + (secs_done + idx) * 512, 512);
+            bhs[idx]->flags |= BH_VALID;
+            bh_unlock(bhs[idx]);
+            brelse(bhs[idx]);
+        }
+        intr_set_status(old_status);
+        secs_done += batch;
+    }
+}
+
+// 经缓存将buf中的sec_cnt个扇区写到硬盘并等待这些扇区落盘，buf可以在用户空间
+void bcache_write_sync(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    bcache_write(hd, lba, buf, sec_cnt);
+    uint32_t idx = 0;
+    while (idx < sec_cnt) {
+        struct buffer_head* bh = getblk(hd, lba + idx);
+        enum intr_status old_status = intr_disable();
+        wait_on_buffer(bh);
+        if (bh->flags & BH_DIRTY) {
+            bh->flags = (bh->flags & ~BH_DIRTY) | BH_LOCKED;
+            bh_submit(bh, BIO_WRITE);
+        }
+        intr_set_status(old_status);
+        wait_on_buffer(bh);
+        brelse(bh);
+        idx++;
+    }
+}
+
+// 将硬盘hd上的脏缓冲区写回并等待完成，hd为NULL表示所有硬盘
+void bcache_sync(struct disk* hd) {
+    bcache_writeback(hd, true);
+}
+
+// 刷回线程，定期将脏缓冲区写回磁盘
+static void bflush(void* arg UNUSED) {
+    while (1) {
+        mtime_sleep(BCACHE_FLUSH_MS);
+        bcache_writeback(NULL, false);
+    }
+}
+
+// 初始化块缓存并启动刷回线程
+void bcache_init(void) {
+    printk("bcache_init start\n");
+    uint32_t bh_pages = DIV_ROUND_UP(BCACHE_NR_BUFFERS * sizeof(struct buffer_head), PG_SIZE);
+    uint32_t data_pages = DIV_ROUND_UP(BCACHE_NR_BUFFERS * 512, PG_SIZE);
+    bh_table = get_kernel_pages(bh_pages);
+    uint8_t* data = get_kernel_pages(data_pages);
+    if (bh_table == NULL || data == NULL) PANIC("bcache_init: alloc memory failed");
+
+    uint32_t idx = 0;
+    while (idx < BCACHE_HASH_SIZE) {
+        list_init(&bh_hash[idx]);
+        idx++;
+    }
+    list_init(&bh_lru);
+
+    // 未使用的缓冲区键为 (NULL, 0)，放在0号桶里，换出时统一从桶中摘下
+    for (idx = 0; idx < BCACHE_NR_BUFFERS; idx++) {
+        struct buffer_head* bh = &bh_table[idx];
+        bh->hd = NULL;
+        bh->lba = 0;
+        bh->data = data + idx * 512;
+        bh->flags = 0;
+        bh->pin_cnt = 0;
+        list_init(&bh->waiters);
+        list_append(&bh_hash[0], &bh->hash_tag);
+        list_append(&bh_lru, &bh->lru_tag);
+    }
+
+    thread_start("bflush", 31, bflush, NULL);
+    printk("bcache_init done\n");
+}
@@ -4,7 +4,9 @@
 #include <fs/inode.h>
 #include <fs/super_block.h>
 #include <device/ide.h>
+#include <fs/bcache.h>
 #include <kernel/memory.h>
+#include <kernel/slab.h>
 #include <kernel/string.h>
 #include <kernel/debug.h>
 #include <kernel/global.h>
@@ -12,6 +14,14 @@
 
 struct dir root_dir;  // 根目录
 
+static struct kmem_cache* dir_cache;  // 目录结构体的cache
+
+// 创建目录结构体的cache
+void dir_cache_init(void) {
+    dir_cache = kmem_cache_create("dir", sizeof(struct dir), NULL, PF_KERNEL);
+    if (dir_cache == NULL) PANIC("dir_cache_init: create cache failed");
+}
+
 // 打开根目录
 void open_root_dir(struct partition* p) {
     root_dir.inode = inode_open(p, p->sb->root_inode_no);
@@ -20,7 +30,8 @@ void open_root_dir(struct partition* p) {
 
 // 打开i结点编号为i_no的目录，返回目录指针
 struct dir* dir_open(struct partition* p, uint32_t i_no) {
-    struct dir* dir = (struct dir*)sys_malloc(sizeof(struct dir));
+    struct dir* dir = (struct dir*)kmem_cache_alloc(dir_cache);
+    if (dir == NULL) return NULL;
     dir->inode = inode_open(p, i_no);
     dir->dir_pose = 0;
     return dir;
@@ -45,10 +56,10 @@ bool search_dir_entry(struct partition* p, struct dir* dir, const char* name, st
 
     // 处理一级间接块
     if (dir->inode->i_sectors[12] != 0) {
-        ide_read(p->my_disk, dir->inode->i_sectors[12], all_blocks + 12, 1);
+        bcache_read(p->my_disk, dir->inode->i_sectors[12], all_blocks + 12, 1);
     }
 
-    uint8_t* buf = (uint8_t*)sys_malloc(SECTOR_SIZE);  // 目录项不会垮扇区
+    uint8_t* buf = (uint8_t*)sys_malloc_nozero(SECTOR_SIZE);  // 目录项不会垮扇区
     struct dir_entry* p_de = (struct dir_entry*)buf;   // p_de为目录项指针，初始值为buf
 
     uint32_t dir_entry_size = p->sb->dir_entry_size;
@@ -61,7 +72,7 @@ bool search_dir_entry(struct partition* p, struct dir* dir, const char* name, st
             block_idx++;
             continue;
         }
-        ide_read(p->my_disk, all_blocks[block_idx], buf, 1);  // 读入扇区数据
+        bcache_read(p->my_disk, all_blocks[block_idx], buf, 1);  // 读入扇区数据
         
         uint32_t dir_entry_idx = 0;
         
@@ -90,7 +101,7 @@ bool search_dir_entry(struct partition* p, struct dir* dir, const char* name, st
 void dir_close(struct dir* dir) {
     if (dir == &root_dir) return; // 根目录在低端1M内存空间，不在堆上
     inode_close(dir->inode);
-    sys_free(dir);
+    kmem_cache_free(dir_cache, dir);
 }
    
 // 在内存中初始化目录项
@@ -122,7 +133,7 @@ bool sync_dir_entry(struct dir* parent_dir, struct dir_entry* p_de, void* io_buf
     }
 
     // if (parent_dir_inode->i_sectors[12] != 0) {
-    //     ide_read(cur_part->my_disk, parent_dir_inode->i_sectors[12], all_blocks + 12, 1);
+    //     bcache_read(cur_part->my_disk, parent_dir_inode->i_sectors[12], all_blocks + 12, 1);
     // }
 
     struct dir_entry* dir_e = (struct dir_entry*)io_buf;  // 目录项指针dir_e现在指向io_buf起始处
@@ -170,30 +181,30 @@ bool sync_dir_entry(struct dir* parent_dir, struct dir_entry* p_de, void* io_buf
                 all_blocks[block_idx] = block_lba;
 
                 // 将新分配的第0个间接块地址写入一级间接块索引表
-                ide_write(cur_part->my_disk, parent_dir_inode->i_sectors[12], all_blocks + 12, 1);
+                bcache_write(cur_part->my_disk, parent_dir_inode->i_sectors[12], all_blocks + 12, 1);
             } else {
                 // 一级间接索引块尚已存在，将间接块地址写入磁盘中的索引表
                 all_blocks[block_idx] = block_lba;
-                ide_write(cur_part->my_disk, parent_dir_inode->i_sectors[12], all_blocks + 12, 1);
+                bcache_write(cur_part->my_disk, parent_dir_inode->i_sectors[12], all_blocks + 12, 1);
             }
 
             // 将目录项写入新分配的块中
             memset(io_buf, 0, 512);
             memcpy(io_buf, p_de, dir_entry_size);        // 将目录项信息写入缓冲区中
-            ide_write(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
+            bcache_write(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
             parent_dir_inode->i_size += dir_entry_size;  // 修改父目录的相关信息
             return true;
         }
 
         // 将数据块读入内存，寻找空的目录项
-        ide_read(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
+        bcache_read(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
         uint8_t dir_entry_idx = 0;
         dir_e = (struct dir_entry*)io_buf; 
         // printk("all_blocks[block_idx] != 0\n");
         while (dir_entry_idx < dir_entrys_per_sec) {
             if ((dir_e + dir_entry_idx)->f_type == FT_UNKOWN) {
                 memcpy((dir_e + dir_entry_idx), p_de, dir_entry_size);  // dir_e指向io_buf起始地址
-                ide_write(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
+                bcache_write(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
                 parent_dir_inode->i_size += dir_entry_size;
                 // printk("return true;");
                 return true;
@@ -219,7 +230,7 @@ bool delete_dir_entry(struct partition* p, struct dir* pgdir, uint32_t i_no, voi
         block_idx++;
     }
     if (dir_inode->i_sectors[12] != 0) {
-        ide_read(&p->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
+        bcache_read(p->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
     }
 
     uint32_t dir_entry_size = p->sb->dir_entry_size;
@@ -239,7 +250,7 @@ bool delete_dir_entry(struct partition* p, struct dir* pgdir, uint32_t i_no, voi
         }
         dir_entry_idx = dir_entry_cnt = 0;
         memset(io_buf, 0, SECTOR_SIZE);
-        ide_read(p->my_disk, all_blocks[block_idx], io_buf, 1);
+        bcache_read(p->my_disk, all_blocks[block_idx], io_buf, 1);
 
         // 遍历目录项，统计该扇区的目录项数量以及是否有待删除的目录项
         while (dir_entry_idx < dir_entrys_per_sec) {
@@ -286,7 +297,7 @@ bool delete_dir_entry(struct partition* p, struct dir* pgdir, uint32_t i_no, voi
 
                 if (indirect_block_cnt > 1) {
                     all_blocks[block_idx] = 0;
-                    ide_write(p->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
+                    bcache_write(p->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
                 } else {
                     // 将索引表本身的地址也回收
                     block_bitmap_idx = dir_inode->i_sectors[12] - p->sb->data_start_lba;
@@ -299,7 +310,7 @@ bool delete_dir_entry(struct partition* p, struct dir* pgdir, uint32_t i_no, voi
         } else {
             // 只需要将该目录项清空
             memset(dir_entry_found, 0, dir_entry_size);
-            ide_write(p->my_disk, all_blocks[block_idx], io_buf, 1);
+            bcache_write(p->my_disk, all_blocks[block_idx], io_buf, 1);
         }
 
         // 修改目录的i_size并将目录inode同步到磁盘
@@ -324,7 +335,7 @@ struct dir_entry* dir_read(struct dir* dir) {
         block_idx++;
     }
     if (inode->i_sectors[12] != 0) {
-        ide_read(cur_part->my_disk, inode->i_sectors[12], all_blocks + 12, 1);
+        bcache_read(cur_part->my_disk, inode->i_sectors[12], all_blocks + 12, 1);
         block_cnt = 140;
     }
     block_idx = 0;
@@ -345,7 +356,7 @@ struct dir_entry* dir_read(struct dir* dir) {
             continue;
         }
         memset(dir_e, 0, 512);
-        ide_read(cur_part->my_disk, all_blocks[block_idx], dir_e, 1);
+        bcache_read(cur_part->my_disk, all_blocks[block_idx], dir_e, 1);
         dir_entry_idx = 0;
         while (dir_entry_idx < dir_entrys_per_sec) {
             if ((dir_e + dir_entry_idx)->f_type != FT_UNKOWN) {
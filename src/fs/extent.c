@@ -0,0 +1,262 @@
+#include <fs/extent.h>
+#include <fs/fs.h>
+#include <fs/file.h>
+#include <fs/inode.h>
+#include <fs/bcache.h>
+#include <fs/super_block.h>
+#include <kernel/debug.h>
+#include <kernel/global.h>
+#include <kernel/string.h>
+#include <kernel/memory.h>
+#include <lib/kernel/stdio-kernel.h>
+
+// i 结点中内联的区段头
+static struct extent_header* inode_eh(struct inode* inode) {
+    return (struct extent_header*)inode->i_sectors;
+}
+
+// 区段头后面紧跟着区段数组
+static struct extent* eh_extents(struct extent_header* eh) {
+    return (struct extent*)(eh + 1);
+}
+
+// 判断i结点是否是区段格式
+bool inode_is_extent(struct inode* inode) {
+    return inode_eh(inode)->eh_magic == EXT_MAGIC;
+}
+
+// 将i结点初始化为空的区段格式
+void extent_init(struct inode* inode) {
+    memset(inode->i_sectors, 0, sizeof(inode->i_sectors));
+    struct extent_header* eh = inode_eh(inode);
+    eh->eh_magic = EXT_MAGIC;
+    eh->eh_entries = 0;
+    eh->eh_depth = 0;
+}
+
+// 文件已经分配的数据块数，深度为1时内联项的长度就是各区段块的总长度
+uint32_t extent_blocks(struct inode* inode) {
+    struct extent_header* eh = inode_eh(inode);
+    struct extent* ext = eh_extents(eh);
+    uint32_t blocks = 0;
+    uint8_t idx = 0;
+    while (idx < eh->eh_entries) {
+        blocks += ext[idx].ee_len;
+        idx++;
+    }
+    return blocks;
+}
+
+// 在区段数组中查找第blk_idx块，*blk_idx 返回它在找到的区段中的偏移，没找到返回NULL
+static struct extent* extent_search(struct extent* ext, uint8_t entries, uint32_t* blk_idx) {
+    uint8_t idx = 0;
+    while (idx < entries) {
+        if (*blk_idx < ext[idx].ee_len) return &ext[idx];
+        *blk_idx -= ext[idx].ee_len;
+        idx++;
+    }
+    return NULL;
+}
+
+// 旧格式的映射，连续块数只统计同一张表（直接块或间接块）中的
+static uint32_t legacy_bmap(struct partition* p, struct inode* inode, uint32_t blk_idx, uint32_t* run_len) {
+    uint32_t* table = inode->i_sectors;
+    uint32_t table_len = 12;
+    struct buffer_head* bh = NULL;
+
+    if (blk_idx >= 12) {
+        if (inode->i_sectors[12] == 0 || blk_idx >= 140) return 0;
+        bh = bread(p->my_disk, inode->i_sectors[12]);
+        table = (uint32_t*)bh->data;
+        table_len = 128;
+        blk_idx -= 12;
+    }
+
+    uint32_t lba = table[blk_idx];
+    uint32_t run = 0;
+    while (lba != 0 && blk_idx + run < table_len && table[blk_idx + run] == lba + run) run++;
+
+    if (bh != NULL) brelse(bh);
+    if (run_len != NULL) *run_len = run;
+    return lba;
+}
+
+/* 查找文件第blk_idx块所在的扇区，*run_len 返回从该扇区起物理连续的块数，
+ * 块不存在时返回0。区段格式下深度为0时不访问磁盘，深度为1时只读一个区段块 */
+uint32_t inode_bmap(struct partition* p, struct inode* inode, uint32_t blk_idx, uint32_t* run_len) {
+    if (!inode_is_extent(inode)) return legacy_bmap(p, inode, blk_idx, run_len);
+
+    struct extent_header* eh = inode_eh(inode);
+    struct extent* ext = extent_search(eh_extents(eh), eh->eh_entries, &blk_idx);
+    if (ext == NULL) return 0;
+
+    uint32_t lba, run;
+    if (eh->eh_depth == 0) {
+        lba = ext->ee_start + blk_idx;
+        run = ext->ee_len - blk_idx;
+    } else {
+        struct buffer_head* bh = bread(p->my_disk, ext->ee_start);
+        struct extent_header* leaf = (struct extent_header*)bh->data;
+        ASSERT(leaf->eh_magic == EXT_MAGIC);
+        struct extent* leaf_ext = extent_search(eh_extents(leaf), leaf->eh_entries, &blk_idx);
+        ASSERT(leaf_ext != NULL);
+        lba = leaf_ext->ee_start + blk_idx;
+        run = leaf_ext->ee_len - blk_idx;
+        brelse(bh);
+    }
+
+    if (run_len != NULL) *run_len = run;
+    return lba;
+}
+
+// 在区段数组末尾追加一段扇区，能接在最后一个区段后面时直接延长，成功返回true
+static bool extent_add(struct extent_header* eh, uint8_t max_entries, uint32_t lba, uint32_t cnt) {
+    struct extent* ext = eh_extents(eh);
+    if (eh->eh_entries > 0) {
+        struct extent* last = &ext[eh->eh_entries - 1];
+        if (last->ee_start + last->ee_len == lba) {
+            last->ee_len += cnt;
+            return true;
+        }
+    }
+    if (eh->eh_entries == max_entries) return false;
+    ext[eh->eh_entries].ee_start = lba;
+    ext[eh->eh_entries].ee_len = cnt;
+    eh->eh_entries++;
+    return true;
+}
+
+// 分配一个区段块，写入区段头，返回引用中的缓冲区，失败返回NULL
+static struct buffer_head* extent_block_alloc(struct partition* p) {
+    int32_t block_lba = block_bitmap_alloc(p);
+    if (block_lba == -1) return NULL;
+    bitmap_sync(p, block_lba - p->sb->data_start_lba, BLOCK_BITMAP);
+
+    struct buffer_head* bh = bnew(p->my_disk, block_lba);
+    struct extent_header* leaf = (struct extent_header*)bh->data;
+    leaf->eh_magic = EXT_MAGIC;
+    leaf->eh_entries = 0;
+    leaf->eh_depth = 0;
+    return bh;
+}
+
+/* 在文件末尾追加从lba开始的cnt个连续扇区，调用者负责同步i结点。
+ * 内联区段满了转为一层区段树，区段数超过上限（文件过于零碎）返回false */
+bool extent_append(struct partition* p, struct inode* inode, uint32_t lba, uint32_t cnt) {
+    ASSERT(inode_is_extent(inode));
+    struct extent_header* eh = inode_eh(inode);
+    struct extent* ext = eh_extents(eh);
+    struct buffer_head* bh;
+
+    if (eh->eh_depth == 0) {
+        if (extent_add(eh, EXT_INLINE_MAX, lba, cnt)) return true;
+
+        // 内联区段已满，搬到新分配的区段块中
+        bh = extent_block_alloc(p);
+        if (bh == NULL) return false;
+        struct extent_header* leaf = (struct extent_header*)bh->data;
+        memcpy(eh_extents(leaf), ext, eh->eh_entries * sizeof(struct extent));
+        leaf->eh_entries = eh->eh_entries;
+
+        ext[0].ee_start = bh->lba;
+        ext[0].ee_len = extent_blocks(inode);
+        eh->eh_entries = 1;
+        eh->eh_depth = 1;
+        brelse(bh);
+    }
+
+    struct extent* last = &ext[eh->eh_entries - 1];
+    bh = bread(p->my_disk, last->ee_start);
+    if (!extent_add((struct extent_header*)bh->data, EXT_BLOCK_MAX, lba, cnt)) {
+        // 最后一个区段块满了，再挂一个新的区段块
+        brelse(bh);
+        if (eh->eh_entries == EXT_INLINE_MAX) {
+            printk("extent_append: file too fragmented\n");
+            return false;
+        }
+        bh = extent_block_alloc(p);
+        if (bh == NULL) return false;
+        extent_add((struct extent_header*)bh->data, EXT_BLOCK_MAX, lba, cnt);
+        last = &ext[eh->eh_entries];
+        last->ee_start = bh->lba;
+        last->ee_len = 0;
+        eh->eh_entries++;
+    }
+    last->ee_len += cnt;
+    bmark_dirty(bh);
+    brelse(bh);
+    return true;
+}
+
+// 把旧格式的普通文件转换成区段格式，原来的数据块不动，只释放一级间接块
+bool extent_convert(struct partition* p, struct inode* inode) {
+    ASSERT(!inode_is_extent(inode));
+    uint32_t* all_blocks = (uint32_t*)sys_malloc(140 * 4);
+    if (all_blocks == NULL) {
+        printk("extent_convert: sys_malloc for all_blocks failed\n");
+        return false;
+    }
+
+    memset(all_blocks, 0, 140 * 4);
+    memcpy(all_blocks, inode->i_sectors, 12 * 4);
+    uint32_t indirect_block = inode->i_sectors[12];
+    if (indirect_block != 0) bcache_read(p->my_disk, indirect_block, all_blocks + 12, 1);
+
+    // 普通文件的数据块是连续编号的，遇到0就结束
+    extent_init(inode);
+    uint32_t block_idx = 0;
+    while (block_idx < 140 && all_blocks[block_idx] != 0) {
+        if (!extent_append(p, inode, all_blocks[block_idx], 1)) {
+            // 先归还转换中分配的区段块，区段内的数据块仍属于旧格式，不能释放
+            struct extent_header* eh = inode_eh(inode);
+            if (eh->eh_depth == 1) {
+                uint8_t idx = 0;
+                while (idx < eh->eh_entries) block_bitmap_free(p, eh_extents(eh)[idx++].ee_start);
+            }
+            // 恢复旧的格式
+            memcpy(inode->i_sectors, all_blocks, 12 * 4);
+            inode->i_sectors[12] = indirect_block;
+            sys_free(all_blocks);
+            return false;
+        }
+        block_idx++;
+    }
+
+    if (indirect_block != 0) block_bitmap_free(p, indirect_block);
+    sys_free(all_blocks);
+    return true;
+}
+
+// 回收区段描述的所有数据块，以及区段块本身
+void extent_release(struct partition* p, struct inode* inode) {
+    struct extent_header* eh = inode_eh(inode);
+    struct extent* ext = eh_extents(eh);
+    uint8_t idx = 0;
+    while (idx < eh->eh_entries) {
+        if (eh->eh_depth == 0) {
+            uint32_t blk = 0;
+            while (blk < ext[idx].ee_len) {
+                block_bitmap_free(p, ext[idx].ee_start + blk);
+                blk++;
+            }
+        } else {
+            struct buffer_head* bh = bread(p->my_disk, ext[idx].ee_start);
+            struct extent_header* leaf = (struct extent_header*)bh->data;
+            struct extent* leaf_ext = eh_extents(leaf);
+            uint8_t leaf_idx = 0;
+            while (leaf_idx < leaf->eh_entries) {
+                uint32_t blk = 0;
+                while (blk < leaf_ext[leaf_idx].ee_len) {
+                    block_bitmap_free(p, leaf_ext[leaf_idx].ee_start + blk);
+                    blk++;
+                }
+                leaf_idx++;
+            }
+            brelse(bh);
+            block_bitmap_free(p, ext[idx].ee_start);
+        }
+        idx++;
+    }
+    eh->eh_entries = 0;
+    eh->eh_depth = 0;
+}
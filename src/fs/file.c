@@ -4,6 +4,8 @@
 #include <fs/inode.h>
 #include <fs/super_block.h>
 #include <device/ide.h>
+#include <fs/bcache.h>
+#include <fs/extent.h>
 #include <kernel/global.h>
 #include <kernel/thread.h>
 #include <kernel/memory.h>
@@ -52,7 +54,7 @@ int32_t pcb_fd_install(int32_t global_fd_idx) {
 
 // 在位图中分配一个i结点
 int32_t inode_bitmap_alloc(struct partition* p) {
-    int32_t bit_idx = bitmap_scan(&p->inode_map, 1); // 扫描位图
+    int32_t bit_idx = bitmap_scan_hint(&p->inode_map); // 从上次分配的位置开始扫描位图
 
     if (bit_idx == -1) return -1;
 
@@ -68,28 +70,132 @@ int32_t block_bitmap_alloc(struct partition* p) {
     return (p->sb->data_start_lba + bit_idx); // 返回扇区地址
 }
 
-// 将内存位图中bit_idx所在的512字节信息同步到磁盘中
+// 释放数据块位图中扇区lba对应的位并同步到磁盘中
+void block_bitmap_free(struct partition* p, uint32_t lba) {
+    uint32_t bit_idx = lba - p->sb->data_start_lba;
+    ASSERT(bit_idx > 0);
+    bitmap_set(&p->block_bitmap, bit_idx, 0);
+    bitmap_sync(p, bit_idx, BLOCK_BITMAP);
+}
+
+// 将位图中从bit_idx开始的cnt位同步到磁盘中，cnt位最多跨两个扇区
+static void block_bitmap_sync_range(struct partition* p, uint32_t bit_idx, uint32_t cnt) {
+    bitmap_sync(p, bit_idx, BLOCK_BITMAP);
+    if ((bit_idx + cnt - 1) / 4096 != bit_idx / 4096) bitmap_sync(p, bit_idx + cnt - 1, BLOCK_BITMAP);
+}
+
+/* 从goal位开始向后（到末尾后回绕）寻找连续的空闲位，找到长度不小于want的空闲区就停止，
+ * 否则取找到的最长的空闲区。*bit_idx 返回空闲区的起始位，返回值是空闲区的长度（最多want），没有空闲位返回0 */
+static uint32_t block_run_scan(struct bitmap* btmp, uint32_t goal, uint32_t want, uint32_t* bit_idx) {
+    uint32_t bits_len = btmp->btmp_bytes_len * 8;
+    uint32_t best_len = 0;
+    uint32_t scanned = 0;
+    uint32_t idx = goal < bits_len ? goal : 0;
+
+    while (scanned < bits_len) {
+        // 跳过占用的位，到末尾后回绕
+        int32_t free_idx = bitmap_next_clear(btmp, idx);
+        if (free_idx == -1) {
+            scanned += bits_len - idx;
+            idx = 0;
+            continue;
+        }
+        scanned += free_idx - idx;
+        idx = free_idx;
+        if (scanned >= bits_len) break;
+
+        // 空闲区到下一个占用位为止，空闲区不跨越位图末尾
+        int32_t used_idx = bitmap_next_set(btmp, idx);
+        uint32_t end = used_idx == -1 ? bits_len : (uint32_t)used_idx;
+        uint32_t run = end - idx < want ? end - idx : want;
+        if (run > best_len) {
+            best_len = run;
+            *bit_idx = idx;
+            if (run == want) break;
+        }
+        scanned += end - idx;
+        idx = end;
+        if (idx >= bits_len) idx = 0;
+    }
+    return best_len;
+}
+
+/* 为文件在末尾分配最多want个物理连续的块，返回起始扇区地址，*got 返回实际分配的块数，失败返回-1。
+ * 优先使用i结点的预分配窗口；窗口用完后以文件最后一块的下一块为目标寻找连续空闲区，
+ * 多找的 FILE_PREALLOC_BLOCKS 块留作新的窗口，这样交错写的文件也各自保持连续 */
+int32_t file_block_alloc(struct partition* p, struct inode* inode, uint32_t want, uint32_t* got) {
+    ASSERT(want > 0);
+    if (inode->i_pa_len == 0) {
+        uint32_t goal = 0;
+        uint32_t blocks = extent_blocks(inode);
+        if (blocks > 0) goal = inode_bmap(p, inode, blocks - 1, NULL) + 1 - p->sb->data_start_lba;
+
+        uint32_t bit_idx;
+        uint32_t run = block_run_scan(&p->block_bitmap, goal, want + FILE_PREALLOC_BLOCKS, &bit_idx);
+        if (run == 0) return -1;
+
+        uint32_t idx = 0;
+        while (idx < run) bitmap_set(&p->block_bitmap, bit_idx + idx++, 1);
+        inode->i_pa_start = p->sb->data_start_lba + bit_idx;
+        inode->i_pa_len = run;
+    }
+
+    uint32_t cnt = want < inode->i_pa_len ? want : inode->i_pa_len;
+    int32_t block_lba = inode->i_pa_start;
+    inode->i_pa_start += cnt;
+    inode->i_pa_len -= cnt;
+
+    block_bitmap_sync_range(p, block_lba - p->sb->data_start_lba, cnt);
+    *got = cnt;
+    return block_lba;
+}
+
+// 归还i结点预分配窗口中没有用掉的块
+void file_prealloc_discard(struct partition* p, struct inode* inode) {
+    if (inode->i_pa_len == 0) return;
+    uint32_t bit_idx = inode->i_pa_start - p->sb->data_start_lba;
+    uint32_t idx = 0;
+    while (idx < inode->i_pa_len) bitmap_set(&p->block_bitmap, bit_idx + idx++, 0);
+    block_bitmap_sync_range(p, bit_idx, inode->i_pa_len);
+    inode->i_pa_start = inode->i_pa_len = 0;
+}
+
+/* 记下内存位图中bit_idx所在的扇区需要写回，不立即写盘，
+ * 由 bitmap_flush 在系统调用结束或写i结点之前把修改过的扇区一次写回 */
 void bitmap_sync(struct partition* p, uint32_t bit_idx, uint8_t bitmap_type) {
     uint32_t off_sec = bit_idx / 4096;         // i结点所在扇区相对于位图的偏移，以扇区为单位
-    uint32_t off_size = off_sec * BLOCK_SIZE;  // i结点所在扇区相对于位图的偏移，以字节为单位
 
-    uint32_t sec_lab;       // 位图的扇区地址
-    uint8_t* bitmap_off;    // 位图的字节偏移量
+    struct bitmap_dirty* dirty = bitmap_type == INODE_BITMAP ? &p->inode_map_dirty : &p->block_bitmap_dirty;
+    enum intr_status old_status = intr_disable();
+    if (dirty->start == dirty->end) {
+        dirty->start = off_sec;
+        dirty->end = off_sec + 1;
+    } else {
+        if (off_sec < dirty->start) dirty->start = off_sec;
+        if (off_sec >= dirty->end) dirty->end = off_sec + 1;
+    }
+    intr_set_status(old_status);
+}
 
-    switch (bitmap_type) {
-        case INODE_BITMAP:
-            sec_lab = p->sb->inode_bitmap_lba + off_sec;  // 扇区地址
-            bitmap_off = p->inode_map.bits + off_size;    // 位图地址
-            break;
+// 将一个位图中修改过的扇区范围整体写到硬盘并等待完成，块缓存中的副本一并更新
+static void bitmap_dirty_flush(struct partition* p, struct bitmap_dirty* dirty, uint32_t bitmap_lba, uint8_t* bits) {
+    enum intr_status old_status = intr_disable();
+    uint32_t start = dirty->start, end = dirty->end;
+    dirty->start = dirty->end = 0;
+    intr_set_status(old_status);
 
-        case BLOCK_BITMAP:
-            sec_lab = p->sb->block_bitmap_lba + off_sec;
-            bitmap_off = p->block_bitmap.bits + off_size;
-            break;
-    }
+    if (start == end) return;
+    bcache_write_direct(p->my_disk, bitmap_lba + start, bits + start * BLOCK_SIZE, end - start);
+}
 
-    // 将信息同步到磁盘中
-    ide_write(p->my_disk, sec_lab, bitmap_off, 1);
+/* 把分区两个位图中修改过的扇区同步写到硬盘，返回时它们都已落盘。
+ * 写i结点之前先调用它，i结点只是进入块缓存，所以位图一定先于引用这些块的i结点落盘。
+ * 加锁是因为另一个线程可能刚取走脏扇区范围还没写完，此时要等它写完再返回 */
+void bitmap_flush(struct partition* p) {
+    lock_acquire(&p->bitmap_lock);
+    bitmap_dirty_flush(p, &p->block_bitmap_dirty, p->sb->block_bitmap_lba, p->block_bitmap.bits);
+    bitmap_dirty_flush(p, &p->inode_map_dirty, p->sb->inode_bitmap_lba, p->inode_map.bits);
+    lock_release(&p->bitmap_lock);
 }
 
 int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
@@ -111,13 +217,14 @@ int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
     /* 申请inode结点
      * 需要从堆中申请内存，不能作为局部变量（函数退出时会释放）
      * file_table数组中文件描述符的i结点指针需要指向他 */
-    struct inode* new_file_inode = (struct inode*)sys_malloc(sizeof(struct inode));
+    struct inode* new_file_inode = inode_alloc();
     if (new_file_inode == NULL) {
         printk("in file_creat: allocate inode failed\n");
         rollback_step = 1;
         goto rollback;
     }
     inode_init(inode_no, new_file_inode);
+    extent_init(new_file_inode);     // 新建的普通文件使用区段映射
 
     // 文件描述符相关
     int32_t fd_idx = get_free_slot_in_global();
@@ -128,6 +235,7 @@ int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
     }
     file_table[fd_idx].fd_flag = flag;
     file_table[fd_idx].fd_pos = 0;
+    file_table[fd_idx].ra_next = file_table[fd_idx].ra_win = file_table[fd_idx].ra_end = 0;
     file_table[fd_idx].fd_inode = new_file_inode;
     file_table[fd_idx].fd_inode->write_deny = false;
 
@@ -145,6 +253,9 @@ int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
         goto rollback;
     }
 
+    // 将i结点位图同步到硬盘，它要先于i结点写入
+    bitmap_sync(cur_part, inode_no, INODE_BITMAP);
+
     // 将父目录i结点信息同步到硬盘
     memset(io_buf, 0, 1024);
     inode_sync(cur_part, parent_dir->inode, io_buf);
@@ -153,9 +264,6 @@ int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
     memset(io_buf, 0, 1024);
     inode_sync(cur_part, new_file_inode, io_buf);
 
-    // 将i结点位图同步到硬盘
-    bitmap_sync(cur_part, inode_no, INODE_BITMAP);
-
     // 将创建的文件i结点添加到open_inodes链表
     list_push(&cur_part->open_inodes, &new_file_inode->inode_tag);
     new_file_inode->i_open_cnt = 1;
@@ -169,7 +277,7 @@ int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
             case 3:
                 memset(&file_table[fd_idx], 0, sizeof(struct file));
             case 2:
-                sys_free(new_file_inode);
+                inode_free(new_file_inode);
             case 1:
                 bitmap_set(&cur_part->inode_map, inode_no, 0);
                 break;
@@ -189,6 +297,7 @@ int32_t file_open(uint32_t i_no, uint8_t flags) {
 
     file_table[fd_idx].fd_inode = inode_open(cur_part, i_no);
     file_table[fd_idx].fd_pos = 0;  // 每次打开文件时，都需要将该值置为0，使其指向文件开头
+    file_table[fd_idx].ra_next = file_table[fd_idx].ra_win = file_table[fd_idx].ra_end = 0;
     file_table[fd_idx].fd_flag = flags;
 
     bool* write_deny = &file_table[fd_idx].fd_inode->write_deny;
@@ -217,6 +326,8 @@ int32_t file_close(struct file* f) {
     if (f == NULL) return -1;
 
     f->fd_inode->write_deny = false;
+    // 最后一次关闭时归还没用完的预分配块
+    if (f->fd_inode->i_open_cnt == 1) file_prealloc_discard(cur_part, f->fd_inode);
     inode_close(f->fd_inode);
     f->fd_inode = NULL; // 使文件结构可用
     return 0;
@@ -224,200 +335,119 @@ int32_t file_close(struct file* f) {
 
 // 将buf中cnt个字节写入文件file，成功返回写入文件的字节数
 int32_t file_write(struct file* file, const void* buf, uint32_t cnt) {
-    if ((file->fd_inode->i_size + cnt) > (BLOCK_SIZE * (12 + 128))) {
-        printk("exceed max file_size 71680 bytes, write file failed\n");
+    struct inode* inode = file->fd_inode;
+
+    // 旧格式的普通文件先转换为区段格式，数据块原地保留
+    if (!inode_is_extent(inode) && !extent_convert(cur_part, inode)) {
+        printk("file_write: extent_convert failed\n");
         return -1;
     }
 
-    uint8_t* io_buf = (uint8_t*)sys_malloc(BLOCK_SIZE);    // 磁盘的读写操作都是以扇区为单位的
+    uint8_t* io_buf = (uint8_t*)sys_malloc_nozero(BLOCK_SIZE * 2);  // inode_sync 需要两个扇区的缓冲区
     if (io_buf == NULL) {
         printk("file_write: sys_malloc for io_buf failed\n");
         return -1;
     }
 
-    uint32_t* all_blocks = (uint32_t*)sys_malloc(140 * 4);  // 用来记录文件140个数据块的块地址
-    if (all_blocks == NULL) {
-        printk("file_write: sys_malloc for all_blocks failed\n");
-        return -1;
+    /* 先分配好写完后需要的全部数据块，每次分配一段连续的块，并入文件最后一个区段
+     * 每次分配块都需要同步 */
+    uint32_t file_will_use_blocks = DIV_ROUND_UP(inode->i_size + cnt, BLOCK_SIZE);
+    uint32_t file_has_used_blocks = extent_blocks(inode);
+    int32_t block_lba;
+    uint32_t block_cnt;
+    while (file_has_used_blocks < file_will_use_blocks) {
+        block_lba = file_block_alloc(cur_part, inode, file_will_use_blocks - file_has_used_blocks, &block_cnt);
+        if (block_lba == -1) {
+            printk("file_write: file_block_alloc failed\n");
+            sys_free(io_buf);
+            return -1;
+        }
+
+        if (!extent_append(cur_part, inode, block_lba, block_cnt)) {
+            // 退回预分配窗口，关闭文件时一并归还
+            inode->i_pa_start = block_lba;
+            inode->i_pa_len += block_cnt;
+            sys_free(io_buf);
+            return -1;
+        }
+        file_has_used_blocks += block_cnt;
     }
 
     const uint8_t* src = (const uint8_t*)buf; //指向buf中待写入的数据
     uint32_t bytes_written = 0;     // 已经写入数据的字节大小
     uint32_t size_left = cnt;       // 剩余待写入的数据大小
-    int32_t block_lba = -1;         // 操作的块地址
-    uint32_t block_bitmap_idx = 0;  // 记录块在block_bitmap中的索引，作为参数传递给bitmap_sync
     uint32_t sec_idx;               // 扇区索引
-    uint32_t sec_lba;               // 扇区地址
+    uint32_t sec_lba = 0;           // 扇区地址
+    uint32_t run_left = 0;          // 当前区段中从sec_lba起剩余的连续扇区数
     uint32_t sec_off_bytes;         // 扇区内的字节偏移
     uint32_t sec_left_bytes;        // 扇区内剩余字节大小
+    uint32_t secs;                  // 本次写的扇区数
     uint32_t chunk_size;            // 每次写入硬盘的数据块大小
-    uint32_t block_idx;             // 块索引
-    int32_t indirect_block_table;   // 一级间接表的地址
-
-    /* 判断文件是不是第一次写，是的话就为他分配一个块
-     * 每次分配块都需要同步 */
-    if (file->fd_inode->i_sectors[0] == 0) {
-
-        block_lba = block_bitmap_alloc(cur_part);
-        
-        if (block_lba == -1) {
-            printk("file_write: block_bitmap_alloc failed\n");
-            return -1;
-        }
-        file->fd_inode->i_sectors[0] = block_lba;
-
-        // 每分配一个数据块就需要同步到磁盘中
-        block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-
-        bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-    }
-
-    // 写文件前，文件已经被占用的块数
-    uint32_t file_has_used_blocks = file->fd_inode->i_size / BLOCK_SIZE + 1;
-
-    // 写文件后，文件占用的块数
-    uint32_t file_will_use_blocks = (file->fd_inode->i_size + cnt) / BLOCK_SIZE + 1;
-    ASSERT(file_will_use_blocks <= 140);
-
-    uint32_t add_blocks = file_will_use_blocks - file_has_used_blocks;
+    struct buffer_head* bh;
+    uint8_t* bounce = NULL;         // 直接写盘用的内核中转缓冲区，第一次用到时分配
+    uint32_t bounce_secs = 0;       // 中转缓冲区的扇区数
 
-    // 将文件的数据块扇区地址存入all_blocks中
-    if (add_blocks == 0) {
-        if (file_has_used_blocks <= 12) {
-            block_idx = file_has_used_blocks - 1; // 指向最后一个数据块
-            all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-        } else {
-            ASSERT(file->fd_inode->i_sectors[12] != 0);
-
-            indirect_block_table = file->fd_inode->i_sectors[12]; // 间接块的扇区地址
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
+    file->fd_pos = inode->i_size - 1; // fd_pose置为文件大小-1
+    while (bytes_written < cnt) {
+        sec_idx = inode->i_size / BLOCK_SIZE;
+        if (run_left == 0) {
+            sec_lba = inode_bmap(cur_part, inode, sec_idx, &run_left);
+            ASSERT(sec_lba != 0);
         }
-    } else {
-        if (file_will_use_blocks <= 12) {
-            // 将原有扇区中包含剩余空间的(可继续用的)块地址存到all_blocks
-            block_idx = file_has_used_blocks - 1;
-            ASSERT(file->fd_inode->i_sectors[block_idx] != 0);
-            all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-
-            // 再将未来要用的扇区分配好并写入all_blocks
-            block_idx = file_has_used_blocks;
-            while (block_idx < file_will_use_blocks) {
-                block_lba = block_bitmap_alloc(cur_part);
-                if (block_lba == -1) {
-                    printk("file_write: block_bitmap_alloc for situation 1 failed\n");
-                    return -1;
-                }
-                ASSERT(file->fd_inode->i_sectors[block_idx] == 0);
-                file->fd_inode->i_sectors[block_idx] = all_blocks[block_idx] = block_lba;
-
-                // 分配扇区时一定要同步到硬盘中
-                block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-                bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-
-                block_idx++;
-            }
-
-        } else if (file_has_used_blocks <= 12 && file_will_use_blocks > 12) {
-            block_idx = file_has_used_blocks - 1;
-            ASSERT(file->fd_inode->i_sectors[block_idx] != 0);
-            all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];  
-
-            // 创建一级间接表
-            block_lba = block_bitmap_alloc(cur_part);
-            if (block_lba == -1) {
-                printk("file_write: block_bitmap_alloc for situation 2 failed\n");
-                return -1;
+        sec_off_bytes = inode->i_size % BLOCK_SIZE;
+
+        if (sec_off_bytes == 0 && size_left >= BLOCK_SIZE) {
+            // 对齐的整扇区不用读也不用拼接，区段内连续的扇区一次写出
+            secs = size_left / BLOCK_SIZE;
+            if (secs > run_left) secs = run_left;
+            if (secs >= FILE_DIRECT_SECS && bounce == NULL) {
+                // 用户进程中 sys_malloc 得到的是用户堆，中转缓冲区要直接从内核内存池分配
+                bounce_secs = size_left / BLOCK_SIZE;
+                if (bounce_secs > FILE_BOUNCE_SECS) bounce_secs = FILE_BOUNCE_SECS;
+                bounce = (uint8_t*)get_kernel_pages(DIV_ROUND_UP(bounce_secs * BLOCK_SIZE, PG_SIZE));
             }
-
-            ASSERT(file->fd_inode->i_sectors[12] == 0);
-            // 分配一级间接索引表
-            indirect_block_table = file->fd_inode->i_sectors[12] = block_lba;
-
-            block_idx = file_has_used_blocks; 
-
-            while (block_idx < file_will_use_blocks) {
-                block_lba = block_bitmap_alloc(cur_part);
-                if (block_lba == -1) {
-                    printk("file_write: block_bitmap_alloc for situation 1 failed\n");
-                    return -1;
-                }
-                
-                if (block_idx < 12) {
-                    // 直接块
-                    ASSERT(file->fd_inode->i_sectors[block_idx] == 0);
-                    file->fd_inode->i_sectors[block_idx] = all_blocks[block_idx] = block_lba;
-                } else {
-                    // 间接块写入先all_blocks数组中，分配完成后一次性同步到磁盘中
-                    all_blocks[block_idx] = block_lba;
-                }
-
-                // 同步
-                block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-                bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-
-                block_idx++;
+            if (secs >= FILE_DIRECT_SECS && bounce != NULL) {
+                /* 足够长的绕过块缓存直接写盘。硬盘中断里才读缓冲区，那时用户页可能还没调入，
+                 * 运行的也可能是别的进程，所以先在进程上下文中复制到内核的中转缓冲区 */
+                if (secs > bounce_secs) secs = bounce_secs;
+                chunk_size = secs * BLOCK_SIZE;
+                memcpy(bounce, src, chunk_size);
+                bcache_write_direct(cur_part->my_disk, sec_lba, bounce, secs);
+            } else {
+                chunk_size = secs * BLOCK_SIZE;
+                bcache_write(cur_part->my_disk, sec_lba, (void*)src, secs);
             }
-            // 将一级间接索引表直接写入硬盘
-            ide_write(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
         } else {
-            ASSERT(file->fd_inode->i_sectors[12] != 0);
-            indirect_block_table = file->fd_inode->i_sectors[12];
-
-            // 获取一级间接表
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-
-            block_idx = file_has_used_blocks;
-            while (block_idx < file_will_use_blocks) {
-                block_lba = block_bitmap_alloc(cur_part);
-                if (block_lba = -1) {
-                    printk("file_write: block_bitmap_alloc for situation 3 failed\n");
-                    return -1;
-                }
-                all_blocks[block_idx++] = block_lba;
-
-                block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-                bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-            }
-            ide_write(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-        }
-    }
-
-    bool first_write_block = true;  // 包含剩余空间的(可继续用的)的扇区
-    file->fd_pos = file->fd_inode->i_size - 1; // fd_pose置为文件大小-1
-    while (bytes_written < cnt) {
-        memset(io_buf, 0, BLOCK_SIZE);
-        sec_idx = file->fd_inode->i_size / BLOCK_SIZE;
-        sec_lba = all_blocks[sec_idx];
-        sec_off_bytes = file->fd_inode->i_size % BLOCK_SIZE;
-        sec_left_bytes = BLOCK_SIZE - sec_off_bytes;
-
-        // 本次写文件的字节大小
-        chunk_size =(size_left < sec_left_bytes) ? size_left : sec_left_bytes;
-        if (first_write_block) {
-            ide_read(cur_part->my_disk, sec_lba, io_buf, 1);
-            first_write_block = false;
+            // 文件是追加写的，只有包含剩余空间的首扇区需要读出原来的数据，尾扇区之后没有数据
+            sec_left_bytes = BLOCK_SIZE - sec_off_bytes;
+            chunk_size = (size_left < sec_left_bytes) ? size_left : sec_left_bytes;
+            secs = 1;
+            bh = sec_off_bytes != 0 ? bread(cur_part->my_disk, sec_lba) : bnew(cur_part->my_disk, sec_lba);
+            memcpy(bh->data + sec_off_bytes, src, chunk_size);
+            bmark_dirty(bh);
+            brelse(bh);
         }
-        memcpy(io_buf + sec_off_bytes, src, chunk_size);
-        printk("file write at lba 0x%x\n", sec_lba); 
-
-        ide_write(cur_part->my_disk, sec_lba, io_buf, 1);
+        TRACE("file write at lba 0x%x, %d sectors\n", sec_lba, secs);
 
+        sec_lba += secs;
+        run_left -= secs;
         src += chunk_size;
-        file->fd_inode->i_size += chunk_size;
+        inode->i_size += chunk_size;
         file->fd_pos += chunk_size;
         bytes_written += chunk_size;
         size_left -= chunk_size;
     }
 
-    inode_sync(cur_part, file->fd_inode, io_buf);
-    sys_free(all_blocks);
+    if (bounce != NULL) mfree_page_locked(PF_KERNEL, bounce, DIV_ROUND_UP(bounce_secs * BLOCK_SIZE, PG_SIZE));
+    inode_sync(cur_part, inode, io_buf);
     sys_free(io_buf);
     return bytes_written;
 }
 
-// 返回读出的字节数，如果读到文件尾则返回-1
-int32_t file_read(struct file* file, void* buf, uint32_t cnt) {
-    uint8_t* buf_dst = (uint8_t*)buf;
+/* 从文件当前位置起读取最多 cnt 个字节，数据不经过中间缓冲区，
+ * 按扇区把块缓存中的数据交给 actor 处理，actor 返回它消费的字节数，少于给出的字节数时提前结束
+ * 返回 actor 消费的字节数，如果读到文件尾则返回-1 */
+int32_t file_read_actor(struct file* file, uint32_t cnt, file_actor actor, void* arg) {
     uint32_t size = cnt;
     uint32_t size_left = cnt;
     
@@ -427,79 +457,79 @@ int32_t file_read(struct file* file, void* buf, uint32_t cnt) {
         if (size == 0) return -1;
     }
 
-    uint8_t* io_buf = (uint8_t*)sys_malloc(512); // 磁盘读写操作的缓冲区
-    if (io_buf == NULL) {
-        printk("file_read: sys_malloc for io_buf failed\n");
-        return -1;
-    }
-
-    uint32_t* all_blocks = (uint32_t*)sys_malloc(140 * 4); // 用来记录该文件所有数据块的地址
-    if (all_blocks == NULL) {
-        printk("file_read: sys_malloc for all_blocks failed\n");
-        return -1;
-    }
-
     uint32_t block_read_start_idx = file->fd_pos / BLOCK_SIZE;  
-    uint32_t block_read_end_idx = (file->fd_pos + size) / BLOCK_SIZE;
-    uint32_t read_blocks = block_read_end_idx - block_read_start_idx;
-
-    ASSERT(block_read_start_idx < 139 && block_read_end_idx < 139 && read_blocks >= 0);
-
-    int32_t indirect_block_table; // 用来存储一级间接表的地址
-    uint32_t block_idx;   
-
-    if (read_blocks == 0) {
-        if (block_read_end_idx < 12) {
-            block_idx = block_read_end_idx;
-            all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-        } else {
-            indirect_block_table = file->fd_inode->i_sectors[12];
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-        } 
+    uint32_t block_read_end_idx = (file->fd_pos + size - 1) / BLOCK_SIZE;
+    uint32_t file_end_idx = (file->fd_inode->i_size - 1) / BLOCK_SIZE;  // 文件最后一个块
+
+    /* 顺序读检测：本次从上次读到的位置接着读时预读窗口加倍，否则清零，
+     * 把本次要读的块和窗口内的后续块一起异步提交，相邻扇区由电梯合并成一条命令 */
+    if (block_read_start_idx == file->ra_next || \
+        (block_read_start_idx + 1 == file->ra_next && file->fd_pos % BLOCK_SIZE != 0)) {
+        file->ra_win = file->ra_win == 0 ? RA_MIN_SECS : file->ra_win * 2;
+        if (file->ra_win > RA_MAX_SECS) file->ra_win = RA_MAX_SECS;
     } else {
-        if (block_read_end_idx < 12) {
-            block_idx = block_read_start_idx;
-            while (block_idx < block_read_end_idx) {
-                all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-                block_idx++;
-            }
-        } else if (block_read_start_idx < 12 && block_read_end_idx >= 12) {
-            block_idx = block_read_start_idx;
-            while (block_idx < 12) {
-                all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-                block_idx++;
-            }
-            ASSERT(file->fd_inode->i_sectors[12] != 0);
-            indirect_block_table = file->fd_inode->i_sectors[12];
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-        } else {
-            ASSERT(file->fd_inode->i_sectors[12] != 0);
-            indirect_block_table = file->fd_inode->i_sectors[12];
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-        }
+        file->ra_win = 0;
+        file->ra_end = 0;
+    }
+    file->ra_next = block_read_end_idx + 1;
+
+    // 按物理连续的区段提交预读，一个区段只查一次映射
+    uint32_t ra_start = block_read_start_idx > file->ra_end ? block_read_start_idx : file->ra_end;
+    uint32_t ra_stop = block_read_end_idx + file->ra_win;
+    if (ra_stop > file_end_idx) ra_stop = file_end_idx;
+    uint32_t block_idx = ra_start;
+    uint32_t run_lba, run_len;
+    while (block_idx <= ra_stop) {
+        run_lba = inode_bmap(cur_part, file->fd_inode, block_idx, &run_len);
+        ASSERT(run_lba != 0);
+        if (run_len > ra_stop - block_idx + 1) run_len = ra_stop - block_idx + 1;
+        bcache_prefetch(cur_part->my_disk, run_lba, run_len);
+        block_idx += run_len;
     }
+    if (ra_start <= ra_stop) file->ra_end = ra_stop + 1;
 
-    // 下面负责读文件
-    uint32_t sec_idx, sec_lba, sec_off_bytes, sec_left_bytes, chunk_size;
+    // 下面负责读文件，直接把缓冲区中的数据交给 actor
+    uint32_t sec_idx, sec_off_bytes, sec_left_bytes, chunk_size, consumed;
+    uint32_t sec_lba = 0, run_left = 0;
     uint32_t bytes_read = 0;
     while (bytes_read < size) {
         sec_idx = file->fd_pos / BLOCK_SIZE;
-        sec_lba = all_blocks[sec_idx];
+        if (run_left == 0) {
+            sec_lba = inode_bmap(cur_part, file->fd_inode, sec_idx, &run_left);
+            ASSERT(sec_lba != 0);
+        }
         sec_off_bytes = file->fd_pos % BLOCK_SIZE;
         sec_left_bytes = BLOCK_SIZE - sec_off_bytes;
         chunk_size = (size_left < sec_left_bytes) ? size_left : sec_left_bytes;
 
-        memset(io_buf, 0, BLOCK_SIZE);
-        ide_read(cur_part->my_disk, sec_lba, io_buf, 1);
-        memcpy(buf_dst, io_buf + sec_off_bytes, chunk_size);
+        struct buffer_head* bh = bread(cur_part->my_disk, sec_lba);
+        consumed = actor(arg, bh->data + sec_off_bytes, chunk_size);
+        brelse(bh);
 
-        buf_dst += chunk_size;
-        file->fd_pos += chunk_size;
-        bytes_read += chunk_size;
-        size_left -= chunk_size;
+        // 读到扇区末尾才前进到下一个扇区
+        if (sec_off_bytes + consumed == BLOCK_SIZE) {
+            sec_lba++;
+            run_left--;
+        }
+        file->fd_pos += consumed;
+        bytes_read += consumed;
+        size_left -= consumed;
+        if (consumed < chunk_size) break;
     }
 
-    sys_free(all_blocks);
-    sys_free(io_buf);
     return bytes_read;
 }
+
+// file_read 的 actor，复制到 arg 指向的目标地址并后移
+static uint32_t copy_actor(void* arg, const void* data, uint32_t len) {
+    uint8_t** buf_dst = arg;
+    memcpy(*buf_dst, data, len);
+    *buf_dst += len;
+    return len;
+}
+
+// 返回读出的字节数，如果读到文件尾则返回-1
+int32_t file_read(struct file* file, void* buf, uint32_t cnt) {
+    uint8_t* buf_dst = (uint8_t*)buf;
+    return file_read_actor(file, cnt, copy_actor, &buf_dst);
+}
@@ -5,6 +5,7 @@
 #include <fs/super_block.h>
 #include <user/pipe.h>
 #include <device/ide.h>
+#include <fs/bcache.h>
 #include <device/console.h>
 #include <device/ioqueue.h>
 #include <device/keyboard.h>
@@ -30,7 +31,7 @@ static void partition_format(struct partition* p) {
    // i结点位图占用的扇区数，此处为1个扇区
    uint32_t inode_bitmap_secs = DIV_ROUND_UP(MAX_FILES_PER_PART, BITS_PER_SECTOR);
    // i结点数组占用的扇区数
-   uint32_t inode_table_secs = DIV_ROUND_UP(((sizeof(struct inode) * MAX_FILES_PER_PART)), SECTOR_SIZE);
+   uint32_t inode_table_secs = DIV_ROUND_UP(((INODE_DISK_SIZE * MAX_FILES_PER_PART)), SECTOR_SIZE);
 
    uint32_t used_secs = boot_sector_secs + super_block_secs + inode_bitmap_secs + inode_table_secs;
    uint32_t free_secs = p->sec_cnt - used_secs;  // 空闲块（位图 +数据块）
@@ -145,25 +146,26 @@ static bool partition_mount(struct list_elem* pelem, int arg) {
         memset(sb_buf, 0, SECTOR_SIZE);
 
         // 将超级块信息读入缓冲区
-        ide_read(hd, cur_part->start_lba + 1, sb_buf, 1);
+        bcache_read(hd, cur_part->start_lba + 1, sb_buf, 1);
 
         // 将超级块信息从缓冲区中复制到内存中的分区超级块，并且舍去了填充数组
         memcpy(cur_part->sb, sb_buf, sizeof(struct super_block));
 
         // 将硬盘中的块位图信息读入内存
-        cur_part->block_bitmap.bits = (uint8_t*)sys_malloc(sb_buf->block_bitmap_secs * SECTOR_SIZE);
+        cur_part->block_bitmap.bits = (uint8_t*)sys_malloc_nozero(sb_buf->block_bitmap_secs * SECTOR_SIZE);
         if (cur_part->block_bitmap.bits == NULL) PANIC("memory allocation failed!!!!!!"); // 物理内存可能不够
         // 并不是真实的位图，最后一个扇区可能含有已经置1的无效位
         cur_part->block_bitmap.btmp_bytes_len = sb_buf->block_bitmap_secs * SECTOR_SIZE;
-        ide_read(hd, sb_buf->block_bitmap_lba, cur_part->block_bitmap.bits, sb_buf->block_bitmap_secs);  
+        bcache_read(hd, sb_buf->block_bitmap_lba, cur_part->block_bitmap.bits, sb_buf->block_bitmap_secs);  
 
         // 将硬盘中的i结点位图信息读入内存
-        cur_part->inode_map.bits = (uint8_t*)sys_malloc(sb_buf->inode_bitmap_secs * SECTOR_SIZE);
+        cur_part->inode_map.bits = (uint8_t*)sys_malloc_nozero(sb_buf->inode_bitmap_secs * SECTOR_SIZE);
         if (cur_part->inode_map.bits == NULL) PANIC("memory allocation failed!!!!!!");
         cur_part->inode_map.btmp_bytes_len = sb_buf->inode_bitmap_secs * SECTOR_SIZE;
-        ide_read(hd, sb_buf->inode_bitmap_lba, cur_part->inode_map.bits, sb_buf->inode_bitmap_secs);
+        bcache_read(hd, sb_buf->inode_bitmap_lba, cur_part->inode_map.bits, sb_buf->inode_bitmap_secs);
 
         list_init(&cur_part->open_inodes); // 初始化分区的已打开i结点列表
+        lock_init(&cur_part->bitmap_lock);
 
         printk("mount %s done!\n", p->name);
 
@@ -369,21 +371,19 @@ uint32_t fd_local_to_global(uint32_t local_fd) {
 // 关闭文件文件描述符指向的文件
 int32_t sys_close(int32_t fd) {
    int32_t ret = -1; // 默认关闭失败
-   if (fd > 2) {
+   if (fd > 2 || (fd >= 0 && is_pipe(fd))) { // 标准输入输出只有被重定向为管道时才需要关闭
       uint32_t global_fd = fd_local_to_global(fd);
-      if (is_pipe(fd)) { // 如果是管道
-         file_table[global_fd].fd_pos--;
-         if (file_table[global_fd].fd_pos == 0) {
-            // 如果该管道上的描述符都被关闭了那就释放管道的环形缓冲区
-            mfree_page(PF_KERNEL, file_table[global_fd].fd_inode, 1);
-            file_table[global_fd].fd_inode = NULL;
-         }
+      if (is_pipe(fd)) { // 如果是管道，释放该管道端的一个引用
+         pipe_put(global_fd);
          ret = 0;
       } else {
          ret = file_close(&file_table[global_fd]);
+         bitmap_flush(cur_part);          // 归还的预分配块
+         bcache_sync(cur_part->my_disk); // 关闭文件时把脏缓冲区写回磁盘
       }
 
-      running_thread()->fdtable[fd] = -1;  // 使该文件描述符位可用
+      // 使该文件描述符位可用，标准输入输出恢复为键盘和屏幕
+      running_thread()->fdtable[fd] = (fd > 2) ? -1 : fd;
       // printk("fd: %d is closing\n", fd);
    }
    return ret;
@@ -400,9 +400,7 @@ int32_t sys_write(int32_t fd, const void* buf, uint32_t cnt) {
       if (is_pipe(fd)) { // 标准输出被重定向为管道缓冲区
          return pipe_write(fd, buf, cnt);
       } else {
-         char tmp[1024] = {0};
-         memcpy(tmp, buf, cnt);
-         console_put_str(tmp);
+         console_write(buf, cnt);
          return cnt;
       }
    } else if (is_pipe(fd)) {
@@ -613,7 +611,7 @@ int32_t sys_mkdir(const char* pathname) {
     dir_e->i_no = parent_dir->inode->i_no;
     dir_e->f_type = FT_DIR;
 
-    ide_write(cur_part->my_disk, new_dir_inode.i_sectors[0], io_buf, 1);
+    bcache_write(cur_part->my_disk, new_dir_inode.i_sectors[0], io_buf, 1);
     new_dir_inode.i_size = 2 * cur_part->sb->dir_entry_size;
 
     struct dir_entry new_dir_entry;
@@ -625,6 +623,9 @@ int32_t sys_mkdir(const char* pathname) {
         rollback_step = 2;
     }
 
+    // 将i结点位图同步到磁盘，它要先于i结点写入
+    bitmap_sync(cur_part, i_no, INODE_BITMAP);
+
     // 将父目录的i结点同步到硬盘
     memset(io_buf, 0, 1024);
     inode_sync(cur_part, parent_dir->inode, io_buf);
@@ -633,9 +634,6 @@ int32_t sys_mkdir(const char* pathname) {
     memset(io_buf, 0, 1024);
     inode_sync(cur_part, &new_dir_inode, io_buf);
 
-    // 将i结点位图同步到磁盘
-    bitmap_sync(cur_part, i_no, INODE_BITMAP);
-
     sys_free(io_buf);
     dir_close(searched_record.parent_dir); // 关闭所创建目录的父目录
     
@@ -733,7 +731,7 @@ static uint32_t get_parent_dir_i_no (uint32_t child_i_no, void* io_buf) {
 
     inode_close(child_dir_inode);
 
-    ide_read(cur_part->my_disk, block_lba, io_buf, 1);
+    bcache_read(cur_part->my_disk, block_lba, io_buf, 1);
 
     struct dir_entry* dir_e = (struct dir_entry*)io_buf;
     ASSERT(dir_e[1].i_no < 4096 && dir_e[1].f_type == FT_DIR);
@@ -755,7 +753,7 @@ static int32_t get_child_dir_name(uint32_t parent_i_no, uint32_t child_i_no, cha
         block_idx++;
     }
     if (parent_dir_inode->i_sectors[12] != 0) {
-        ide_read(cur_part->my_disk, parent_dir_inode->i_sectors[12], all_blocks + 12, 1);
+        bcache_read(cur_part->my_disk, parent_dir_inode->i_sectors[12], all_blocks + 12, 1);
         block_cnt = 140;
     }
 
@@ -768,7 +766,7 @@ static int32_t get_child_dir_name(uint32_t parent_i_no, uint32_t child_i_no, cha
     block_idx = 0;
     while (block_idx < block_cnt) {
         if (all_blocks[block_idx]) {
-            ide_read(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
+            bcache_read(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
             uint8_t dir_entry_idx = 0;
             while (dir_entry_idx < dir_entrys_per_sec) {
                 if ((dir_e + dir_entry_idx)->i_no == child_i_no) {
@@ -896,6 +894,7 @@ void sys_help(void) {
         rm: remove a regular file\n\
         pwd: show current work directory\n\
         ps: show process information\n\
+        iostat: show disk request queue statistics\n\
         clear: clear screen\n\
     shortcut key:\n\
         ctrl+l: clear screen\n\
@@ -910,6 +909,9 @@ void filesys_init() {
     struct super_block* sb_buf = (struct super_block*)sys_malloc(SECTOR_SIZE);
     if (sb_buf == NULL) PANIC("memory allocation failed!!!!!!");
 
+    inode_cache_init();
+    dir_cache_init();
+
     printk("searching file system ......");
 
     while (channel_no < channel_cnt) {   // 遍历通道
@@ -3,11 +3,14 @@
 #include <fs/inode.h>
 #include <fs/super_block.h>
 #include <device/ide.h>
+#include <fs/bcache.h>
+#include <fs/extent.h>
 #include <kernel/list.h>
 #include <kernel/debug.h>
 #include <kernel/global.h>
 #include <kernel/string.h>
 #include <kernel/memory.h>
+#include <kernel/slab.h>
 #include <kernel/thread.h>
 #include <kernel/interrupt.h>
 #include <lib/kernel/stdio-kernel.h>
@@ -25,7 +28,7 @@ static void locate_inode(struct partition* p, uint32_t i_no, struct inode_pos* i
 
     uint32_t inode_table_lba = p->sb->inode_table_lba;
 
-    uint32_t inode_size = sizeof(struct inode);
+    uint32_t inode_size = INODE_DISK_SIZE;
     uint32_t off_size = i_no * inode_size;      // i结点相当于i结点表的字节偏移
     uint32_t off_sec = off_size / 512;          // i结点所在扇区相当于i结点表的扇区偏移
     uint32_t off_size_in_sec = off_size % 512;  // i结点在扇区内的偏移
@@ -49,6 +52,9 @@ void inode_sync(struct partition* p, struct inode* inode, void* io_buf) {
     locate_inode(p, i_no, &inode_pos); // 将i结点的位置信息读入结构体中
     ASSERT(inode_pos.sec_lba <= (p->start_lba + p->sec_cnt));
 
+    // 先写出本次分配的块和i结点在位图中的记录
+    bitmap_flush(p);
+
     // 磁盘中的i结点不需要i_open_cnt和inode_tag等信息，将这些信息清空后再写入磁盘
     struct inode pure_inde;
     memcpy(&pure_inde, inode, sizeof(struct inode));
@@ -61,16 +67,33 @@ void inode_sync(struct partition* p, struct inode* inode, void* io_buf) {
     char* inode_buf = (char*)io_buf;        // 此缓冲区用于拼接同步的i结点数据
 
     if (inode_pos.two_secs) {
-       ide_read(p->my_disk, inode_pos.sec_lba, inode_buf, 2);
-       memcpy((inode_buf + inode_pos.off_size), &pure_inde, sizeof(struct inode)); // 修改i结点相关的信息
-       ide_write(p->my_disk, inode_pos.sec_lba, inode_buf, 2);
+       bcache_read(p->my_disk, inode_pos.sec_lba, inode_buf, 2);
+       memcpy((inode_buf + inode_pos.off_size), &pure_inde, INODE_DISK_SIZE); // 修改i结点相关的信息
+       bcache_write(p->my_disk, inode_pos.sec_lba, inode_buf, 2);
     } else {
-       ide_read(p->my_disk, inode_pos.sec_lba, inode_buf, 1);
-       memcpy((inode_buf + inode_pos.off_size), &pure_inde, sizeof(struct inode));
-       ide_write(p->my_disk, inode_pos.sec_lba, inode_buf, 1);
+       bcache_read(p->my_disk, inode_pos.sec_lba, inode_buf, 1);
+       memcpy((inode_buf + inode_pos.off_size), &pure_inde, INODE_DISK_SIZE);
+       bcache_write(p->my_disk, inode_pos.sec_lba, inode_buf, 1);
    }
 }
 
+static struct kmem_cache* inode_cache;  // 内存中i结点的cache
+
+// 创建i结点的cache
+void inode_cache_init(void) {
+    inode_cache = kmem_cache_create("inode", sizeof(struct inode), NULL, PF_KERNEL);
+    if (inode_cache == NULL) PANIC("inode_cache_init: create cache failed");
+}
+
+// 分配内存中的i结点，它被所有任务共享，因此总是来自内核内存池
+struct inode* inode_alloc(void) {
+    return (struct inode*)kmem_cache_alloc(inode_cache);
+}
+
+void inode_free(struct inode* inode) {
+    kmem_cache_free(inode_cache, inode);
+}
+
 // 根据i结点编号找到i结点
 struct inode* inode_open(struct partition* p, uint32_t i_no)
 {
@@ -90,28 +113,24 @@ struct inode* inode_open(struct partition* p, uint32_t i_no)
     struct inode_pos i_pos;
     locate_inode(p, i_no, &i_pos); // 获取该i结点在磁盘上的位置
 
-    // inode队列中的结点应该被所有任务共享，需在内核的堆空间中创建
-    struct task_struct* cur = running_thread();
-    uint32_t* cur_pgdir_tmp = cur->pgdir;
-    
-    // sys_malloc中判断如果页表为空会在内核空间中进行分配，并没有真正地修改页表
-    cur->pgdir = NULL;
-    inode_found = (struct inode*)sys_malloc(sizeof(struct inode));
-    cur->pgdir = cur_pgdir_tmp;
+    // inode队列中的结点应该被所有任务共享，从内核内存池的cache中分配
+    inode_found = inode_alloc();
+    if (inode_found == NULL) return NULL;
 
     char* inode_buf;
 
     // 将i结点信息从磁盘中读入缓冲区
     if (i_pos.two_secs) {
-       inode_buf = (char*)sys_malloc(1024);
-       ide_read(p->my_disk, i_pos.sec_lba, inode_buf, 2);
+       inode_buf = (char*)sys_malloc_nozero(1024);
+       bcache_read(p->my_disk, i_pos.sec_lba, inode_buf, 2);
     } else {
-       inode_buf = (char*)sys_malloc(512);
-       ide_read(p->my_disk, i_pos.sec_lba, inode_buf, 1);
+       inode_buf = (char*)sys_malloc_nozero(512);
+       bcache_read(p->my_disk, i_pos.sec_lba, inode_buf, 1);
     }
 
     // 将i结点信息从缓冲区中（以扇区为单位）复制到i结点结构体中
-    memcpy(inode_found, inode_buf + i_pos.off_size, sizeof(struct inode));
+    memcpy(inode_found, inode_buf + i_pos.off_size, INODE_DISK_SIZE);
+    inode_found->i_pa_start = inode_found->i_pa_len = 0;
  
     // 根据程序局部性原理，加入i结点队头
     list_push(&p->open_inodes, &inode_found->inode_tag);
@@ -132,18 +151,13 @@ void inode_close(struct inode* inode) {
     if (inode->i_open_cnt == 0) {
        list_remove(&inode->inode_tag);
 
-       // 该i结点的内存空间是在内核的堆空间中申请的
-       struct task_struct* cur = running_thread();
-       uint32_t* cur_pgdir_tmp = cur->pgdir;
-       cur->pgdir = NULL;
-       sys_free(inode);
-       cur->pgdir = cur_pgdir_tmp;
+       inode_free(inode);
     }
     intr_set_status(old_status);
 }
 
 
-// 将硬盘上i结点的数据清空
+// 将硬盘上i结点的数据清空，同步写盘，返回时已落盘
 void inode_delete(struct partition* p, uint32_t i_no, void* io_buf) {
    ASSERT(i_no < 4096);
    struct inode_pos i_pos;
@@ -154,13 +168,13 @@ void inode_delete(struct partition* p, uint32_t i_no, void* io_buf) {
 
    char* inode_buf = (char*)io_buf;
    if (i_pos.two_secs) {
-      ide_read(cur_part->my_disk, i_pos.sec_lba, inode_buf, 2);
-      memset(inode_buf + i_pos.off_size, 0, sizeof(struct inode));
-      ide_write(cur_part->my_disk, i_pos.sec_lba, inode_buf, 2);
+      bcache_read(cur_part->my_disk, i_pos.sec_lba, inode_buf, 2);
+      memset(inode_buf + i_pos.off_size, 0, INODE_DISK_SIZE);
+      bcache_write_sync(cur_part->my_disk, i_pos.sec_lba, inode_buf, 2);
    } else {
-      ide_read(cur_part->my_disk, i_pos.sec_lba, inode_buf, 1);
-      memset(inode_buf + i_pos.off_size, 0, sizeof(struct inode));
-      ide_write(cur_part->my_disk, i_pos.sec_lba, inode_buf, 1);
+      bcache_read(cur_part->my_disk, i_pos.sec_lba, inode_buf, 1);
+      memset(inode_buf + i_pos.off_size, 0, INODE_DISK_SIZE);
+      bcache_write_sync(cur_part->my_disk, i_pos.sec_lba, inode_buf, 1);
    }
 }
 
@@ -169,40 +183,51 @@ void inode_release(struct partition* p, uint32_t i_no) {
    struct inode* inode_to_del = inode_open(p, i_no);
    ASSERT(inode_to_del->i_no == i_no);
 
-   // 回收i结点占用的数据块
-   uint8_t block_idx = 0, block_cnt = 12;
-   uint32_t block_bitmap_idx;
-   uint32_t all_blocks[140] = {0};
+   /* 回收时与分配时的顺序相反，先把硬盘上的i结点清掉再释放位图。
+    * 释放位图后任何线程的 bitmap_flush 都可能把它写盘，此时已没有i结点引用这些块 */
+   void* io_buf = sys_malloc(1024);
+   inode_delete(p, i_no, io_buf);
+   sys_free(io_buf);
 
-   while (block_idx < 12) {
-      all_blocks[block_idx] = inode_to_del->i_sectors[block_idx];
-      block_idx++;
-   }
+   // 回收i结点占用的数据块，区段格式的普通文件按区段回收
+   if (inode_is_extent(inode_to_del)) {
+      file_prealloc_discard(p, inode_to_del);
+      extent_release(p, inode_to_del);
+   } else {
+      uint8_t block_idx = 0, block_cnt = 12;
+      uint32_t block_bitmap_idx;
+      uint32_t all_blocks[140] = {0};
 
-   if (inode_to_del->i_sectors[12] != 0) {
-      // 一级块存在，将间接块地址收集到all_blocks数组中
-      ide_read(p->my_disk, inode_to_del->i_sectors[12], all_blocks + 12, 1);
-      block_cnt = 140;
+      while (block_idx < 12) {
+         all_blocks[block_idx] = inode_to_del->i_sectors[block_idx];
+         block_idx++;
+      }
 
-      // 释放一级间接索引表本身的扇区地址
-      block_bitmap_idx = inode_to_del->i_sectors[12] - p->sb->data_start_lba;
-      ASSERT (block_bitmap_idx > 0);
-      bitmap_set(&p->block_bitmap, block_bitmap_idx, 0);
-      bitmap_sync(p, block_bitmap_idx, BLOCK_BITMAP);
-   }
+      if (inode_to_del->i_sectors[12] != 0) {
+         // 一级块存在，将间接块地址收集到all_blocks数组中
+         bcache_read(p->my_disk, inode_to_del->i_sectors[12], all_blocks + 12, 1);
+         block_cnt = 140;
 
-   /* 回收数据块占用的扇区
-    * 普通文件数据是连续存储的不存在中间某个地址为空的情况
-    * 目录文件会存在中间某个地址为空的情况 */
-   block_idx = 0;
-   while (block_idx < 139) {
-      if (all_blocks[block_idx] != 0) {
-         block_bitmap_idx = all_blocks[block_idx] - p->sb->data_start_lba;
-         ASSERT(block_bitmap_idx > 0);
+         // 释放一级间接索引表本身的扇区地址
+         block_bitmap_idx = inode_to_del->i_sectors[12] - p->sb->data_start_lba;
+         ASSERT (block_bitmap_idx > 0);
          bitmap_set(&p->block_bitmap, block_bitmap_idx, 0);
          bitmap_sync(p, block_bitmap_idx, BLOCK_BITMAP);
       }
-      block_idx++;
+
+      /* 回收数据块占用的扇区
+       * 普通文件数据是连续存储的不存在中间某个地址为空的情况
+       * 目录文件会存在中间某个地址为空的情况 */
+      block_idx = 0;
+      while (block_idx < 139) {
+         if (all_blocks[block_idx] != 0) {
+            block_bitmap_idx = all_blocks[block_idx] - p->sb->data_start_lba;
+            ASSERT(block_bitmap_idx > 0);
+            bitmap_set(&p->block_bitmap, block_bitmap_idx, 0);
+            bitmap_sync(p, block_bitmap_idx, BLOCK_BITMAP);
+         }
+         block_idx++;
+      }
    }
 
    // 回收占用的inode数据本身
@@ -210,10 +235,7 @@ void inode_release(struct partition* p, uint32_t i_no) {
 
    bitmap_sync(p, i_no, INODE_BITMAP);
 
-   // 硬盘数据并不需要清0，下次使用时直接覆盖即可
-   void* io_buf = sys_malloc(1024);
-   inode_delete(p, i_no, io_buf);
-   sys_free(io_buf);
+   bitmap_flush(p);
 
    inode_close(inode_to_del);
 
@@ -225,6 +247,7 @@ void inode_init(uint32_t i_no, struct inode* new_inode) {
     new_inode->i_open_cnt = 0;
     new_inode->i_size = 0;
     new_inode->write_deny = false;
+    new_inode->i_pa_start = new_inode->i_pa_len = 0;
 
     uint8_t sec_idx = 0;
     // 文件/i结点被创建的时候并不用分配扇区，当写文件时才真正分配扇区
@@ -9,6 +9,7 @@ void console_release();
 void console_put_str(char* str);
 void console_put_char(uint8_t ch);
 void console_put_int(uint32_t num);
+void console_write(const char* buf, uint32_t len);
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,10 @@
+#ifndef __DEVICE_ELEVATOR_H
+#define __DEVICE_ELEVATOR_H
+#include <device/ide.h>
+
+#define ELV_MAX_REQ_SECS 256 // 合并后的请求最多的扇区数，保证一条命令就能完成
+
+void elv_add_bio(struct ide_channel* channel, struct bio* bio);
+struct bio* elv_next_request(struct ide_channel* channel);
+void elv_print_stat(struct ide_channel* channel);
+#endif
@@ -5,6 +5,12 @@
 #include <kernel/list.h>
 #include <kernel/sync.h>
 
+// 位图中待写回磁盘的扇区范围 [start, end)，以相对位图起始的扇区为单位，start == end 表示没有
+struct bitmap_dirty {
+    uint32_t start;
+    uint32_t end;
+};
+
 struct partition // 分区
 {
     uint32_t start_lba;          // 开始扇区
@@ -16,6 +22,9 @@ struct partition // 分区
     struct bitmap block_bitmap;  // 块位图，用于管理本分区所有的块
     struct bitmap inode_map;     // i结点管理位图
     struct list open_inodes;     // 分区所打开的inode队列，文件系统中用到
+    struct bitmap_dirty block_bitmap_dirty;  // 块位图中修改过还没写回的扇区
+    struct bitmap_dirty inode_map_dirty;     // i结点位图中修改过还没写回的扇区
+    struct lock bitmap_lock;                 // 串行化位图写回，拿到锁时之前取走的脏扇区都已落盘
 };
 
 // 硬盘
@@ -23,10 +32,33 @@ struct disk {
     char name[8];
     struct ide_channel* my_channel;  // 本硬盘所属的通道
     uint8_t dev_no;                  // 0是主盘，1是从盘
+    uint8_t multi_secs;              // READ/WRITE MULTIPLE 每次中断传输的扇区数，为0表示不支持
     struct partition prim_parts[4];  // 主分区
     struct partition logic_parts[8]; // 逻辑分区
 };
 
+#define BIO_READ  0
+#define BIO_WRITE 1
+
+struct bio;
+typedef void bio_end_io(struct bio* bio);
+
+// 一次磁盘请求的描述符，提交后由通道的请求队列依次执行
+struct bio {
+    struct disk* hd;
+    uint32_t lba;                // 起始扇区
+    uint32_t sec_cnt;            // 扇区数
+    void* buf;                   // 数据缓冲区
+    uint8_t rw;                  // BIO_READ 或 BIO_WRITE
+    uint32_t secs_done;          // 已经完成的扇区数
+    bio_end_io* end_io;          // 完成回调，在中断中执行，为NULL时唤醒 done
+    void* private;               // 供完成回调使用
+    struct semaphore done;       // 同步等待请求完成
+    struct list_elem queue_tag;  // 请求队列中的节点
+    struct bio* merge_next;      // 被电梯合并到同一条命令中的下一个请求
+    uint32_t req_secs;           // 作为合并后请求的队首时，整个请求的扇区数
+};
+
 // 
 struct ide_channel {
     char name[8];
@@ -34,7 +66,21 @@ struct ide_channel {
     uint8_t irq_no;              // 本通道的中断号
     struct lock lock;
     bool expecting_intr;         // 本通道正在等待硬盘中断
-    struct semaphore disk_done;  // 驱动程序的信号量
+    struct semaphore disk_done;  // 驱动程序的信号量，识别硬盘等不经过请求队列的命令使用
+    struct list bio_queue;       // 等待执行的请求队列
+    struct bio* cur_bio;         // 正在执行的请求（合并后请求的队首）
+    uint32_t req_done;           // 当前请求已完成的扇区数
+    uint32_t cmd_secs;           // 当前命令要传输的扇区数
+    uint32_t cmd_done;           // 当前命令已传输的扇区数
+    struct bio* xfer_bio;        // 下一个扇区的数据属于合并请求中的哪个 bio
+    uint32_t xfer_off;           // 下一个扇区在 xfer_bio 中的偏移
+    uint32_t plugged;            // 不为0时只排队不下发，便于一批请求先排序合并
+    uint32_t head_key;           // 上一个下发的请求结束的位置，C-LOOK 从这里继续向上扫描
+    uint32_t queue_depth;        // 队列中等待的请求数
+    uint32_t max_depth;          // 队列深度的最大值
+    uint32_t depth_sum;          // 每次下发时队列深度的累加，用于求平均深度
+    uint32_t dispatch_cnt;       // 下发的请求数
+    uint32_t merge_cnt;          // 被合并的 bio 数
     struct disk devices[2];      // 一个通道有2个硬盘
 };
 
@@ -43,8 +89,14 @@ extern struct ide_channel channels[];
 extern struct list partition_list;
 
 void ide_init();
+void bio_init(struct bio* bio, struct disk* hd, uint8_t rw, uint32_t lba, void* buf, uint32_t sec_cnt);
+void ide_submit(struct bio* bio);
+void ide_plug(struct disk* hd);
+void ide_unplug(struct disk* hd);
+void bio_wait(struct bio* bio);
 void ide_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
 void ide_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
 void intr_hd_handler(uint8_t irq_no);
+void sys_iostat(void);
 #endif
 
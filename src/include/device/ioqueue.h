@@ -4,7 +4,7 @@
 #include <kernel/sync.h>
 #include <kernel/thread.h>
 
-#define bufsize 2048
+#define bufsize 2048  // 缓冲区默认大小
 
 struct ioqueue
 {
@@ -13,17 +13,26 @@ struct ioqueue
     struct task_struct* producer; //缓冲区满时在此缓冲区睡眠的生产者
     struct task_struct* consumer; //缓冲区空时在此缓冲区睡眠的消费者
 
-    char buf[bufsize];
+    char* buf;          // 缓冲区，默认指向 data，也可以指向调用者另外分配的更大的缓冲区
+    uint32_t size;      // 缓冲区的大小，最多存放 size - 1 个字节
     int32_t head, tail;
+    char data[bufsize];
 };
 
 void ioqueue_init(struct ioqueue* ioq);
+void ioqueue_set_buf(struct ioqueue* ioq, char* buf, uint32_t size);
 bool ioq_empty(struct ioqueue* ioq);
 bool ioq_full(struct ioqueue* ioq);
 char ioq_get_char(struct ioqueue* ioq);
 void ioq_put_char(struct ioqueue* ioq, char ch);
+void ioq_wait(struct task_struct** waiter);
+void ioq_wakeup(struct task_struct** waiter);
 
 uint32_t ioq_length(struct ioqueue* ioq);
+uint32_t ioq_read_bulk(struct ioqueue* ioq, void* buf, uint32_t cnt);
+uint32_t ioq_write_bulk(struct ioqueue* ioq, const void* buf, uint32_t cnt);
+uint32_t ioq_peek(struct ioqueue* ioq, char** data);
+void ioq_consume(struct ioqueue* ioq, uint32_t len);
 
 #endif
 
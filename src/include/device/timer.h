@@ -1,8 +1,14 @@
 #ifndef _DEVICE_TIMER_H
 #define _DEVICE_TIMER_H
 #include <kernel/global.h>
+#include <kernel/thread.h>
+extern uint32_t ticks;
+
 void timer_init();
 
 void mtime_sleep(uint32_t m_seconds);
+uint32_t mtime_to_ticks(uint32_t m_seconds);
+void timer_add_sleeper(struct task_struct* pthread, uint32_t wakeup_tick);
+void timer_del_sleeper(struct task_struct* pthread);
 
 #endif
\ No newline at end of file
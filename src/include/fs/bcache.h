@@ -0,0 +1,41 @@
+#ifndef __FS_BCACHE_H
+#define __FS_BCACHE_H
+#include <kernel/list.h>
+#include <kernel/global.h>
+#include <device/ide.h>
+
+#define BCACHE_NR_BUFFERS 256   // 缓冲区个数，每个缓存一个扇区
+#define BCACHE_HASH_SIZE  64    // 散列表的桶数
+#define BCACHE_BATCH      32    // 多扇区读写时一批最多同时占用的缓冲区数
+#define BCACHE_FLUSH_MS   1000  // 刷回线程的周期
+
+// 缓冲区的状态
+#define BH_VALID  0x1           // 数据与磁盘一致或更新
+#define BH_DIRTY  0x2           // 数据被修改过，尚未写回
+#define BH_LOCKED 0x4           // 正在进行磁盘读写
+
+// 缓冲区头，以 (硬盘, 扇区地址) 为键
+struct buffer_head {
+    struct disk* hd;
+    uint32_t lba;
+    uint8_t* data;              // 扇区数据，512字节
+    uint8_t flags;
+    uint32_t pin_cnt;           // 引用计数，不为0时不会被换出或写回
+    struct list_elem hash_tag;  // 散列桶中的节点
+    struct list_elem lru_tag;   // LRU 队列中的节点，只有未被引用的缓冲区在 LRU 队列中
+    struct list waiters;        // 等待磁盘读写完成的线程
+    struct bio bio;             // 读写本缓冲区的请求
+};
+
+void bcache_init(void);
+struct buffer_head* bread(struct disk* hd, uint32_t lba);
+struct buffer_head* bnew(struct disk* hd, uint32_t lba);
+void brelse(struct buffer_head* bh);
+void bmark_dirty(struct buffer_head* bh);
+void bcache_prefetch(struct disk* hd, uint32_t lba, uint32_t cnt);
+void bcache_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
+void bcache_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
+void bcache_write_direct(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
+void bcache_write_sync(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
+void bcache_sync(struct disk* hd);
+#endif
@@ -26,6 +26,7 @@ struct dir_entry
 
 extern struct dir root_dir;
 
+void dir_cache_init(void);
 void open_root_dir(struct partition* p);
 struct dir* dir_open(struct partition* p, uint32_t i_no);
 bool search_dir_entry(struct partition* p, struct dir* dir, const char* name, struct dir_entry* dir_e);
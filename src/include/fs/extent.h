@@ -0,0 +1,40 @@
+#ifndef __FS_EXTENT_H
+#define __FS_EXTENT_H
+#include <fs/inode.h>
+#include <device/ide.h>
+#include <kernel/global.h>
+
+/**
+ * 区段映射的 i 结点格式.
+ * 普通文件用 (起始扇区, 扇区数) 的区段描述数据块，区段头和区段放在 i_sectors 的52个字节里，
+ * 内联的区段放不下时转为一层区段树：内联项指向区段块，每个区段块再存放最多63个区段。
+ * 旧格式 i_sectors[0] 是扇区地址或0，不可能等于 EXT_MAGIC，据此区分两种格式，
+ * 目录仍然使用旧的直接块加一级间接块格式。
+ */
+
+#define EXT_MAGIC      0xe47e0000  // 区段格式的标记，大于任何扇区地址
+#define EXT_INLINE_MAX 5           // i_sectors 中能放下的区段数
+#define EXT_BLOCK_MAX  63          // 一个区段块中能放下的区段数
+
+// 区段头
+struct extent_header {
+    uint32_t eh_magic;     // EXT_MAGIC
+    uint8_t eh_entries;    // 有效的区段数
+    uint8_t eh_depth;      // 0 表示区段直接描述数据块，1 表示区段指向区段块
+    uint16_t eh_pad;
+};
+
+// 区段，深度为1的内联项中 ee_start 是区段块的扇区地址，ee_len 是该区段块描述的扇区总数
+struct extent {
+    uint32_t ee_start;     // 起始扇区
+    uint32_t ee_len;       // 扇区数
+};
+
+bool inode_is_extent(struct inode* inode);
+void extent_init(struct inode* inode);
+uint32_t extent_blocks(struct inode* inode);
+uint32_t inode_bmap(struct partition* p, struct inode* inode, uint32_t blk_idx, uint32_t* run_len);
+bool extent_append(struct partition* p, struct inode* inode, uint32_t lba, uint32_t cnt);
+bool extent_convert(struct partition* p, struct inode* inode);
+void extent_release(struct partition* p, struct inode* inode);
+#endif
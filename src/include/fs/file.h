@@ -6,6 +6,13 @@
 
 #define MAX_FILES_OPEN 32 // 系统可打开的最大文件次数，因为一个文件可以多次打开
 
+#define RA_MIN_SECS 4     // 检测到顺序读时的初始预读窗口，以扇区为单位
+#define RA_MAX_SECS 32    // 预读窗口的上限
+
+#define FILE_PREALLOC_BLOCKS 8  // 写文件分配块时为该文件多预留的连续块数
+#define FILE_DIRECT_SECS 8      // 连续整扇区达到这个数时绕过块缓存直接写盘
+#define FILE_BOUNCE_SECS 64     // 直接写盘时中转缓冲区的扇区数，一次最多写这么多
+
 
 
 // 文件结构
@@ -13,6 +20,9 @@ struct file {
     uint32_t fd_pos;  // 文件操作在文件内的偏移量 管道：打开数
     uint32_t fd_flag; // 文件操作标识符 管道：PIPE_FLAG 0xFFFF
     struct inode* fd_inode;  // 管道：管道的内存缓冲区
+    uint32_t ra_next;        // 顺序读时下一次应该从哪个块开始
+    uint32_t ra_win;         // 当前的预读窗口，随顺序读加倍，随机读时清零
+    uint32_t ra_end;         // 已经预读到的块号的下一个
 };
 
 // 标准输入输出描述符
@@ -34,7 +44,11 @@ int32_t get_free_slot_in_global();
 int32_t pcb_fd_install(int32_t global_fd_idx);
 int32_t inode_bitmap_alloc(struct partition* p);
 int32_t block_bitmap_alloc(struct partition* p);
+void block_bitmap_free(struct partition* p, uint32_t lba);
+int32_t file_block_alloc(struct partition* p, struct inode* inode, uint32_t want, uint32_t* got);
+void file_prealloc_discard(struct partition* p, struct inode* inode);
 void bitmap_sync(struct partition* p, uint32_t bit_idx, uint8_t bitmap_type);
+void bitmap_flush(struct partition* p);
 
 int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag);
 
@@ -44,5 +58,9 @@ int32_t file_close(struct file* f);
 int32_t file_write(struct file* file, const void* buf, uint32_t cnt);
 int32_t file_read(struct file* file, void* buf, uint32_t cnt);
 
+// 处理一段文件数据，返回消费的字节数
+typedef uint32_t (*file_actor)(void* arg, const void* data, uint32_t len);
+int32_t file_read_actor(struct file* file, uint32_t cnt, file_actor actor, void* arg);
+
 #endif
 
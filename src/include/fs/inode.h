@@ -14,8 +14,17 @@ struct inode {
     uint32_t i_sectors[13];  // 前12个是直接块指针，第13个存储的是一级间接块指针
     struct list_elem inode_tag;  // i结点的标识，用于加入已打开的i结点列表，inode缓存
 
+    // 以下成员只在内存中，不写入磁盘
+    uint32_t i_pa_start;     // 预分配窗口的起始扇区，窗口中的块已在位图中占用但还不属于文件
+    uint32_t i_pa_len;       // 预分配窗口中剩余的块数
 };
+
+#define INODE_DISK_SIZE offset(struct inode, i_pa_start)  // 磁盘上i结点的大小
+
 void inode_sync(struct partition* p, struct inode* inode, void* io_buf);
+void inode_cache_init(void);
+struct inode* inode_alloc(void);
+void inode_free(struct inode* inode);
 struct inode* inode_open(struct partition* p, uint32_t i_no);
 void inode_init(uint32_t i_no, struct inode* new_inode);
 void inode_close(struct inode* inode);
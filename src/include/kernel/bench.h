@@ -0,0 +1,11 @@
+#ifndef __KERNEL_BENCH_H
+#define __KERNEL_BENCH_H
+
+/**
+ * 内核微基准测试，编译时定义 KBENCH 才会编译和运行.
+ */
+# ifdef KBENCH
+void bench_run(void);
+# endif
+
+#endif
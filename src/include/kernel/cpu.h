@@ -0,0 +1,94 @@
+#ifndef __KERNEL_CPU_H
+#define __KERNEL_CPU_H
+#include <lib/kernel/stdint.h>
+
+/**
+ * 读取时间戳计数器，返回开机以来的时钟周期数.
+ */
+static inline uint64_t rdtsc(void) {
+    uint32_t low, high;
+    asm volatile ("rdtsc" : "=a" (low), "=d" (high));
+    return ((uint64_t)high << 32) | low;
+}
+
+/**
+ * 执行cpuid，leaf为功能号.
+ */
+static inline void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    asm volatile ("cpuid" : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx) : "a" (leaf), "c" (0));
+}
+
+// cpuid功能号1时edx中的特性位
+# define CPUID_EDX_PSE  (1 << 3)
+# define CPUID_EDX_SEP  (1 << 11)
+# define CPUID_EDX_PGE  (1 << 13)
+# define CPUID_EDX_FXSR (1 << 24)
+# define CPUID_EDX_SSE2 (1 << 26)
+
+static inline uint32_t read_cr0(void) {
+    uint32_t cr0;
+    asm volatile ("movl %%cr0, %0" : "=r" (cr0));
+    return cr0;
+}
+
+static inline void write_cr0(uint32_t cr0) {
+    asm volatile ("movl %0, %%cr0" : : "r" (cr0) : "memory");
+}
+
+static inline uint32_t read_cr4(void) {
+    uint32_t cr4;
+    asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+    return cr4;
+}
+
+static inline void write_cr4(uint32_t cr4) {
+    asm volatile ("movl %0, %%cr4" : : "r" (cr4) : "memory");
+}
+
+static inline uint32_t read_cr3(void) {
+    uint32_t cr3;
+    asm volatile ("movl %%cr3, %0" : "=r" (cr3));
+    return cr3;
+}
+
+// 写cr3会刷新TLB中所有非全局的项
+static inline void write_cr3(uint32_t cr3) {
+    asm volatile ("movl %0, %%cr3" : : "r" (cr3) : "memory");
+}
+
+/**
+ * 只使TLB中虚拟页vaddr的那一项失效，全局页也会失效.
+ */
+static inline void invlpg(uint32_t vaddr) {
+    asm volatile ("invlpg (%0)" : : "r" (vaddr) : "memory");
+}
+
+/**
+ * 写模型相关寄存器msr.
+ */
+static inline void wrmsr(uint32_t msr, uint64_t val) {
+    asm volatile ("wrmsr" : : "c" (msr), "a" ((uint32_t)val), "d" ((uint32_t)(val >> 32)));
+}
+
+# define MSR_SYSENTER_CS  0x174
+# define MSR_SYSENTER_ESP 0x175
+# define MSR_SYSENTER_EIP 0x176
+
+/**
+ * sysenter/sysexit是否可用，早期的Pentium Pro（family 6，model和stepping都小于3）会误报SEP.
+ */
+static inline int cpu_has_sysenter(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EDX_SEP)) return 0;
+    return !(((eax >> 8) & 0xf) == 6 && ((eax >> 4) & 0xf) < 3 && (eax & 0xf) < 3);
+}
+
+# define CR0_MP (1 << 1)
+# define CR0_EM (1 << 2)
+# define CR4_PSE (1 << 4)
+# define CR4_PGE (1 << 7)
+# define CR4_OSFXSR (1 << 9)
+# define CR4_OSXMMEXCPT (1 << 10)
+
+#endif
@@ -12,6 +12,16 @@ void panic_spin(char* filename, int line, const char* func, const char* conditio
  */ 
 # define PANIC(...) panic_spin (__FILE__, __LINE__, __func__, __VA_ARGS__)
 
+/**
+ * 跟踪输出，编译时定义 KTRACE 才打印，用法同 printk.
+ * 磁盘读写等热路径上的逐扇区信息用它输出，默认不占用控制台.
+ */
+# ifdef KTRACE
+    # define TRACE(...) printk(__VA_ARGS__)
+# else
+    # define TRACE(...) ((void) 0)
+# endif
+
 # ifdef NDEBUG
     # define ASSERT(CONDITION) ((void) 0)
 # else
@@ -44,6 +44,13 @@
 #define GDT_ATTR_HIGH		 ((DESC_G_4K << 7) + (DESC_D_32 << 6) + (DESC_L << 5) + (DESC_AVL << 4))
 #define GDT_CODE_ATTR_LOW_DPL3	 ((DESC_P << 7) + (DESC_DPL_3 << 5) + (DESC_S_CODE << 4) + DESC_TYPE_CODE)
 #define GDT_DATA_ATTR_LOW_DPL3	 ((DESC_P << 7) + (DESC_DPL_3 << 5) + (DESC_S_DATA << 4) + DESC_TYPE_DATA)
+#define GDT_CODE_ATTR_LOW_DPL0	 ((DESC_P << 7) + (DESC_DPL_0 << 5) + (DESC_S_CODE << 4) + DESC_TYPE_CODE)
+#define GDT_DATA_ATTR_LOW_DPL0	 ((DESC_P << 7) + (DESC_DPL_0 << 5) + (DESC_S_DATA << 4) + DESC_TYPE_DATA)
+
+/* sysenter 使用的代码段为 MSR_SYSENTER_CS，栈段为其后一项；sysexit 使用再往后的两项作为 3 级代码段和栈段
+ * 原有描述符的排列不满足这个要求，所以从第 7 项起另外放一组平坦的 0 级代码段、数据段和 3 级代码段、数据段 */
+#define SELECTOR_SYSENTER_CS ((7 << 3) + (TI_GDT << 2) + RPL0)
+#define GDT_DESC_CNT 11
 
 /* TSS描述符属性  */
 #define TSS_DESC_D  0 
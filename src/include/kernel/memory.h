@@ -14,13 +14,23 @@
 // 系统级
 # define PG_US_S 0
 # define PG_US_U 4
+// 写时复制，使用页表项中留给软件的第9位
+# define PG_COW 0x200
+// 页目录项直接映射4MB的大页
+# define PG_PS 0x80
+// 全局页，重新加载cr3时TLB中的这一项不失效
+# define PG_G 0x100
+
+// 内核直接映射区的起始虚拟地址，启用大页时内核页的虚拟地址为物理地址加上它
+# define K_DIRECT_BASE 0xc0000000
 
 /**
  * 内存池类型标志.
  */ 
 enum pool_flags {
     PF_KERNEL = 1,  // 内核类型
-    PF_USER = 2
+    PF_USER = 2,
+    PF_ZERO = 4     // 与上面的类型组合使用，要求页的内容为0，优先取预先清零的页框
 };
 
 struct virtual_addr {
@@ -31,23 +41,40 @@ struct virtual_addr {
 
 extern struct pool kernel_pool, user_pool;
 
+// 临时映射物理页框的窗口，位于第1022个页目录项的范围内，所有进程共享这张页表
+# define KMAP_BASE 0xff800000
+enum kmap_slot {
+    KMAP_ZERO,      // idle线程清零页框
+    KMAP_PGTABLE,   // 访问其他地址空间的页表，持有 kernel_pool.lock 时使用
+    KMAP_SLOTS
+};
+
 
 // 内存块
 struct mem_block {
     struct list_elem free_elem;
 };
 
+#define MAG_SIZE 8               // 每个描述符的弹匣最多缓存的空闲块数
+#define MAG_BATCH (MAG_SIZE / 2) // 弹匣空了或满了时与空闲链表成批交换的块数
+
 //内存块描述符
 struct mem_block_desc {
     uint32_t block_size;         // 内存块大小
     uint32_t block_per_arena;    // 一个arena能够提供的内存块个数
     struct list free_list;       // 空闲 mem_block 链表，可以由多个 arena 提供内存块
+
+    /* 弹匣，缓存最近释放的块，存取时只关中断不加锁，空了或满了才持锁和 free_list 成批交换
+     * 内核的描述符全局共享，用户进程的描述符在各自的PCB中 */
+    struct mem_block* mag[MAG_SIZE];
+    uint32_t mag_cnt;
 };
 
 #define DESC_CNT 7               //内存块描述符个数
 
 void mem_init(void);
 void* get_kernel_pages(uint32_t page_count);
+void* get_kernel_pages_contig(uint32_t pg_cnt);
 void* get_user_pages(uint32_t page_count);
 void* malloc_page(enum pool_flags pf, uint32_t page_count);
 
@@ -61,14 +88,25 @@ uint32_t addr_v2p(uint32_t vaddr);
 void block_desc_init(struct mem_block_desc* desc_array);
 
 void* sys_malloc(uint32_t size);
+void* sys_malloc_nozero(uint32_t size);
 
 void pfree(uint32_t pg_phy_addr);
 void mfree_page(enum pool_flags pf, void* _vaddr, uint32_t pg_cnt);
+void mfree_page_locked(enum pool_flags pf, void* _vaddr, uint32_t pg_cnt);
 
 void sys_free(void* ptr);
 
 void* get_a_page_without_opvaddrbitmap(enum pool_flags pf, uint32_t vaddr);
 
 void free_a_phy_page(uint32_t pg_phy_addr);
+
+void page_table_set(uint32_t vaddr, uint32_t pte);
+void page_table_set_in(uint32_t* pgdir, uint32_t vaddr, uint32_t pte_val);
+void* kmap(uint32_t slot, uint32_t pg_phy_addr);
+void kunmap(uint32_t slot);
+bool zero_pool_refill(void);
+void user_page_unmap(uint32_t vaddr);
+uint32_t cow_share_page(uint32_t vaddr);
+bool cow_page_fault(uint32_t vaddr);
 # endif
 
@@ -0,0 +1,50 @@
+#ifndef __KERNEL_SLAB_H
+#define __KERNEL_SLAB_H
+#include <lib/kernel/stdint.h>
+#include <lib/kernel/bitmap.h>
+#include <kernel/list.h>
+#include <kernel/sync.h>
+#include <kernel/memory.h>
+
+#define SLAB_MIN_OBJ 16                            // 对象最小16字节
+#define SLAB_MAP_BYTES (PG_SIZE / SLAB_MIN_OBJ / 8) // 每个slab空闲位图的字节数
+
+typedef void (*slab_ctor)(void* obj);
+
+/**
+ * 一个slab占一页，页首为slab头，其后为对象.
+ * 释放对象时将地址按页对齐即可找到所属slab.
+ */
+struct slab {
+    struct kmem_cache* cache;        // 所属的cache
+    struct list_elem slab_tag;       // 挂在cache的partial/full/empty链表上
+    uint32_t inuse;                  // 已分配的对象数
+    struct bitmap free_map;          // 对象分配位图，1表示已分配
+    uint8_t map_bits[SLAB_MAP_BYTES];
+};
+
+/**
+ * 固定大小对象的缓存.
+ */
+struct kmem_cache {
+    const char* name;
+    uint32_t obj_size;               // 对象大小（已对齐）
+    uint32_t objs_per_slab;          // 每个slab中的对象数
+    uint32_t obj_offset;             // 第一个对象相对页首的偏移
+    enum pool_flags pf;              // slab页来自的内存池
+    slab_ctor ctor;                  // 对象构造函数，slab创建时对每个对象调用一次
+
+    struct list partial;             // 部分分配的slab
+    struct list full;                // 全部分配的slab
+    struct list empty;               // 空闲的slab
+    uint32_t empty_cnt;
+    struct lock lock;
+};
+
+void slab_init(void);
+struct kmem_cache* kmem_cache_create(const char* name, uint32_t obj_size, slab_ctor ctor, enum pool_flags pf);
+void* kmem_cache_alloc(struct kmem_cache* cache);
+void kmem_cache_free(struct kmem_cache* cache, void* obj);
+void kmem_cache_destroy(struct kmem_cache* cache);
+
+#endif
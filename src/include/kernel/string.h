@@ -3,6 +3,7 @@
 
 # include <lib/kernel/stdint.h>
 
+void string_sse2_enable(void);
 void memset(void* dst_, uint8_t value, uint32_t size);
 void memcpy(void* dst_, const void* src_, uint32_t size);
 int memcmp(const void* a_, const void* b_, uint32_t size);
@@ -21,6 +21,7 @@ void sema_init(struct semaphore* psema, uint8_t value);
 void lock_init(struct lock* plock);
 
 void sema_down(struct semaphore* psema);
+bool sema_down_timeout(struct semaphore* psema, uint32_t m_seconds);
 void sema_up(struct semaphore* psema);
 
 void lock_acquire(struct lock* plock);
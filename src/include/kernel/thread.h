@@ -7,12 +7,39 @@
 #include <lib/kernel/bitmap.h>
 
 #define PG_SIZE 4096
+struct semaphore;
+struct inode;
 typedef void thread_func(void*);
 typedef int16_t pid_t;
 
 #define MAX_FILES_OPEN_PER_PROC 8 // 每个进程最多打开文件的数量
 
 #define TASK_NAME_LEN 16
+
+#define MAX_VMAS 4 // 每个进程最多记录的可加载段数
+
+// 按需调页的虚拟内存区域，对应 ELF 的一个可加载段
+struct vm_area {
+   uint32_t start;          // 段的起始虚拟地址
+   uint32_t mem_sz;         // 段在内存中的大小，超出 file_sz 的部分是 bss
+   uint32_t file_sz;        // 段在文件中的大小
+   uint32_t file_off;       // 段在文件中的偏移
+   struct inode* inode;     // 段所在文件的i结点，NULL 表示该项未使用
+};
+
+/* 调度策略，便于和原来的轮询调度对比。loader 没有给内核传参数的办法，
+ * 所以是编译时由 SCHED_POLICY 选择，换成轮询调度要加 -DSCHED_POLICY=SCHED_RR 重新编译 */
+enum sched_policy {
+    SCHED_RR,   // 单一就绪队列的时间片轮转
+    SCHED_MLFQ  // 多级反馈队列
+};
+
+#ifndef SCHED_POLICY
+#define SCHED_POLICY SCHED_MLFQ
+#endif
+
+#define MLFQ_LEVELS 4        // 多级反馈队列的级数，0 级优先级最高
+#define MLFQ_BOOST_TICKS 100 // 每隔多少个嘀嗒把所有任务提升到 0 级，防止饥饿
 //进程的状态
 enum task_status {
     TASK_RUNNING,
@@ -88,11 +115,23 @@ struct task_struct {
    pid_t parent_pid;      // 父进程的pid
 
    int8_t exit_status;    // 进程的退出状态值，进程结束时自己调用exit传递的参数
+
+   uint32_t wakeup_tick;             // 睡眠到期的 ticks
+   struct list_elem sleep_tag;       // 定时轮槽位中的节点
+   struct semaphore* sleep_sema;     // 限时等待的信号量，不在限时等待时为NULL
+   bool timed_out;                   // 限时等待是否因超时而被唤醒
+
+   struct vm_area vmas[MAX_VMAS]; // execv 记录的可加载段，缺页时据此从文件调入
+
+   uint8_t mlfq_level;    // 在多级反馈队列中所处的级别
+   uint32_t level_ticks;  // 进入当前级别时的 elapsed_ticks，用于计算本级已用的配额
    uint32_t stack_magic;  // 栈的边界标记，用于检测栈溢出
 };
 
 extern struct list thread_ready_list;
 extern struct list thread_all_list;
+extern enum sched_policy sched_policy;
+extern struct task_struct* idle_thread;
 
 void thread_create(struct task_struct* pthread, thread_func function, void* func_args);
 void init_thread(struct task_struct* pthread, char* name, int prio);
@@ -106,6 +145,10 @@ void thread_unblock(struct task_struct *pthread);
 
 void thread_yield(void);
 
+uint8_t thread_slice(struct task_struct* pthread);
+void ready_list_append(struct task_struct* pthread);
+bool sched_need_preempt(struct task_struct* cur);
+
 pid_t fork_pid();
 
 void sys_ps();
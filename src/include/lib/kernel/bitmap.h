@@ -8,11 +8,16 @@
 struct bitmap {
     uint32_t btmp_bytes_len;
     uint8_t* bits;
+    uint32_t hint;     // bitmap_scan_hint 下次开始查找的位置
 };
 
 void bitmap_init(struct bitmap* btmap);
 uint8_t bitmap_scan_test(struct bitmap* btmap, uint32_t bit_idx);
 int bitmap_scan(struct bitmap* btmap, uint32_t cnt);
+int bitmap_scan_hint(struct bitmap* btmap);
+int bitmap_next_clear(struct bitmap* btmap, uint32_t from);
+int bitmap_next_set(struct bitmap* btmap, uint32_t from);
+int bitmap_longest_run(struct bitmap* btmap, uint32_t* run_len);
 void bitmap_set(struct bitmap* btmap, uint32_t index, int8_t value);
 
 #endif
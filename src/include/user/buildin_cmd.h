@@ -14,5 +14,6 @@ int32_t buildin_rmdir(uint32_t argc, char** argv);
 int32_t buildin_rm(uint32_t argc, char** argv);
 
 void buildin_help(uint32_t argc, char** argv);
+void buildin_iostat(uint32_t argc, char** argv UNUSED);
 
 #endif
\ No newline at end of file
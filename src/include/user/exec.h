@@ -1,6 +1,17 @@
 #ifndef __USER_EXEC_H
 #define __USER_EXEC_H
 #include <lib/kernel/stdint.h>
+#include <kernel/global.h>
+
+struct task_struct;
+
+// 为1时 execv 只记录可加载段，页在第一次访问时由缺页异常调入；为0时启动前全部读入
+#ifndef EXEC_DEMAND_PAGING
+#define EXEC_DEMAND_PAGING 1
+#endif
 
 int32_t sys_execv(const char* pathname, const char* argv[]);
+bool vma_page_fault(uint32_t vaddr);
+void vma_release(struct task_struct* pthread);
+void vma_fork(struct task_struct* child);
 #endif
\ No newline at end of file
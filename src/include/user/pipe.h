@@ -1,13 +1,35 @@
 #ifndef __USER_PIPE_H
 #define __USER_PIPE_H
 
+#include <device/ioqueue.h>
+#include <lib/kernel/stdint.h>
+
 #define PIPE_FLAG 0xFFFF
+#define PIPE_MAX_SIZE (16 * PG_SIZE)  // pipe_sized 能指定的最大缓冲区
+
+// 管道的两端，复用在 file 结构的 fd_pos 中
+enum pipe_end {
+    PIPE_READ,  // 读端
+    PIPE_WRITE  // 写端
+};
+
+// 管道：读端和写端各占一个全局文件表项，共享同一个环形缓冲区
+struct pipe {
+    struct ioqueue ioq;  // 环形缓冲区，必须是第一个成员，slab 构造时按 ioqueue 初始化
+    uint32_t readers;    // 读端被多少个文件描述符引用
+    uint32_t writers;    // 写端被多少个文件描述符引用
+};
 
+void pipe_init(void);
+void pipe_get(uint32_t global_fd);
+void pipe_put(uint32_t global_fd);
 bool is_pipe(uint32_t local_fd);
 int32_t sys_pipe(int32_t pipefd[2]);
+int32_t sys_pipe_sized(int32_t pipefd[2], uint32_t size);
 
-uint32_t pipe_read(int32_t local_fd, void* buf, uint32_t cnt);
-uint32_t pipe_write(int32_t local_fd, const void* buf, uint32_t cnt);
+int32_t pipe_read(int32_t local_fd, void* buf, uint32_t cnt);
+int32_t pipe_write(int32_t local_fd, const void* buf, uint32_t cnt);
+int32_t sys_splice(int32_t fd_in, int32_t fd_out, uint32_t cnt);
 
 void sys_fd_redirect(uint32_t old_local_fd, uint32_t new_local_fd);
-#endif
\ No newline at end of file
+#endif
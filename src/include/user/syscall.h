@@ -34,7 +34,10 @@ enum SYSCALL_NR {
     SYS_EXIT,
     SYS_PIPE,
     SYS_FD_REDIRECT,
-    SYS_HELP
+    SYS_HELP,
+    SYS_PIPE_SIZED,
+    SYS_SPLICE,
+    SYS_IOSTAT
 };
 
 uint32_t getpid(void);
@@ -72,8 +75,11 @@ pid_t wait(int32_t* status);
 void  exit(int32_t status);
 
 int32_t pipe(int32_t pipe_fd[2]);
+int32_t pipe_sized(int32_t pipe_fd[2], uint32_t size);
+int32_t splice(int32_t fd_in, int32_t fd_out, uint32_t cnt);
 
 void fd_redirect(uint32_t old_local_fd, uint32_t new_local_fd);
 
 void help();
+void iostat();
 #endif
\ No newline at end of file
@@ -0,0 +1,9 @@
+#ifndef __USER_VDSO_INIT_H
+#define __USER_VDSO_INIT_H
+#include <kernel/thread.h>
+
+void vdso_init(void);
+void vdso_switch(struct task_struct* cur, struct task_struct* next);
+void vdso_tick(struct task_struct* cur);
+
+#endif
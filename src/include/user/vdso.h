@@ -0,0 +1,26 @@
+#ifndef __USER_VDSO_H
+#define __USER_VDSO_H
+#include <lib/kernel/stdint.h>
+#include <kernel/thread.h>
+
+// vDSO 数据页的固定地址，位于 KMAP_BASE 所在页表的最后一页，所有进程共享这张页表，用户只读
+#define VDSO_DATA_VADDR 0xffbff000
+
+/* 内核维护的数据页，任务切换和时钟中断时更新
+ * 内核更新期间 seq 为奇数，读者读取前后 seq 相同且为偶数时读到的数据才是一致的 */
+struct vdso_data {
+    volatile uint32_t seq;
+    int32_t pid;             // 当前任务的 pid
+    int32_t ppid;            // 当前任务的父进程 pid
+    uint32_t ticks;          // 开中断以来的时钟嘀嗒数
+    uint32_t elapsed_ticks;  // 当前任务已占用的嘀嗒数
+    uint32_t nr_switches;    // 任务切换的次数
+    uint32_t idle_ticks;     // idle 线程占用的嘀嗒数
+};
+
+pid_t vdso_getpid(void);
+pid_t vdso_getppid(void);
+uint32_t vdso_ticks(void);
+void vdso_snapshot(struct vdso_data* snap);
+
+#endif
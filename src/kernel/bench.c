@@ -0,0 +1,298 @@
+#include <kernel/bench.h>
+
+# ifdef KBENCH
+#include <kernel/cpu.h>
+#include <kernel/global.h>
+#include <kernel/string.h>
+#include <kernel/memory.h>
+#include <kernel/thread.h>
+#include <kernel/interrupt.h>
+#include <device/ioqueue.h>
+#include <user/process.h>
+#include <lib/kernel/bitmap.h>
+#include <lib/kernel/stdio-kernel.h>
+
+#define BENCH_BITMAP_BYTES 4096   // 32768位，与一个扇区大小的块位图相当
+#define BENCH_ROUNDS 16
+
+static uint8_t bench_bits[BENCH_BITMAP_BYTES];
+static uint32_t bench_seed = 1;
+
+static uint32_t bench_rand(void) {
+    bench_seed = bench_seed * 1103515245 + 12345;
+    return bench_seed >> 16;
+}
+
+// 原来逐字节、逐位的扫描方法，作为对照
+static int bitmap_scan_bytewise(struct bitmap* btmp, uint32_t cnt) {
+    uint32_t idx_byte = 0;
+    while (idx_byte < btmp->btmp_bytes_len && btmp->bits[idx_byte] == 0xff) idx_byte++;
+    if (idx_byte == btmp->btmp_bytes_len) return -1;
+
+    uint32_t next_bit = idx_byte * 8, count = 0;
+    uint32_t bits_len = btmp->btmp_bytes_len * 8;
+    while (next_bit < bits_len) {
+        count = bitmap_scan_test(btmp, next_bit) ? 0 : count + 1;
+        if (count == cnt) return next_bit - cnt + 1;
+        next_bit++;
+    }
+    return -1;
+}
+
+// 按千分比fill_permille随机占用位图中的位
+static void bench_fill(struct bitmap* btmp, uint32_t fill_permille) {
+    uint32_t idx = 0, bits_len = btmp->btmp_bytes_len * 8;
+    bitmap_init(btmp);
+    while (idx < bits_len) {
+        if (bench_rand() % 1000 < fill_permille) bitmap_set(btmp, idx, 1);
+        idx++;
+    }
+}
+
+// 返回每次调用平均的时钟周期数
+static uint32_t bench_scan(struct bitmap* btmp, uint32_t cnt, bool bytewise) {
+    uint32_t round = 0;
+    uint64_t start = rdtsc();
+    while (round++ < BENCH_ROUNDS) {
+        if (bytewise) {
+            bitmap_scan_bytewise(btmp, cnt);
+        } else {
+            bitmap_scan(btmp, cnt);
+        }
+    }
+    return (uint32_t)(rdtsc() - start) / BENCH_ROUNDS;
+}
+
+static uint32_t bench_longest(struct bitmap* btmp) {
+    uint32_t round = 0, run_len;
+    uint64_t start = rdtsc();
+    while (round++ < BENCH_ROUNDS) bitmap_longest_run(btmp, &run_len);
+    return (uint32_t)(rdtsc() - start) / BENCH_ROUNDS;
+}
+
+// 在不同的占用比例下比较位图扫描的开销
+static void bench_bitmap(void) {
+    static const uint32_t fills[] = {0, 500, 900, 990, 999};
+    struct bitmap btmp;
+    btmp.bits = bench_bits;
+    btmp.btmp_bytes_len = BENCH_BITMAP_BYTES;
+
+    printk("bitmap_scan cycles/call, %d bits\n", BENCH_BITMAP_BYTES * 8);
+    printk("fill   byte(1)  word(1)  byte(8)  word(8)  longest\n");
+    uint32_t i = 0;
+    while (i < sizeof(fills) / sizeof(fills[0])) {
+        bench_fill(&btmp, fills[i]);
+        printk("%d  %d  %d  %d  %d  %d\n", fills[i],
+               bench_scan(&btmp, 1, true), bench_scan(&btmp, 1, false),
+               bench_scan(&btmp, 8, true), bench_scan(&btmp, 8, false),
+               bench_longest(&btmp));
+        i++;
+    }
+}
+
+static uint8_t bench_src[PG_SIZE], bench_dst[PG_SIZE];
+
+// 原来逐字节的实现，作为对照
+static void memcpy_bytewise(void* dst_, const void* src_, uint32_t size) {
+    uint8_t* dst = dst_;
+    const uint8_t* src = src_;
+    while (size-- > 0) *dst++ = *src++;
+}
+
+static void memset_bytewise(void* dst_, uint8_t value, uint32_t size) {
+    uint8_t* dst = dst_;
+    while (size-- > 0) *dst++ = value;
+}
+
+static int memcmp_bytewise(const void* a_, const void* b_, uint32_t size) {
+    const char* a = a_;
+    const char* b = b_;
+    while (size-- > 0) {
+        if (*a != *b) return *a > *b ? 1 : -1;
+        a++;
+        b++;
+    }
+    return 0;
+}
+
+static uint32_t strlen_bytewise(const char* str) {
+    const char* p = str;
+    while (*p++);
+    return p - str - 1;
+}
+
+enum bench_op { OP_MEMCPY, OP_MEMSET, OP_MEMCMP, OP_STRLEN };
+
+static uint32_t bench_op(enum bench_op op, uint32_t size, bool bytewise) {
+    uint32_t round = 0;
+    uint64_t start = rdtsc();
+    while (round++ < BENCH_ROUNDS) {
+        switch (op) {
+            case OP_MEMCPY:
+                bytewise ? memcpy_bytewise(bench_dst, bench_src, size) : memcpy(bench_dst, bench_src, size);
+                break;
+            case OP_MEMSET:
+                bytewise ? memset_bytewise(bench_dst, 0, size) : memset(bench_dst, 0, size);
+                break;
+            case OP_MEMCMP:
+                bytewise ? memcmp_bytewise(bench_dst, bench_src, size) : memcmp(bench_dst, bench_src, size);
+                break;
+            case OP_STRLEN:
+                bytewise ? strlen_bytewise((char*)bench_src) : strlen((char*)bench_src);
+                break;
+        }
+    }
+    return (uint32_t)(rdtsc() - start) / BENCH_ROUNDS;
+}
+
+// 比较字符串函数新旧实现在不同长度下的开销
+static void bench_string(void) {
+    static const uint32_t sizes[] = {16, 64, 256, 1024, 4096};
+    printk("string cycles/call, old/new\n");
+    printk("size  memcpy  memset  memcmp  strlen\n");
+    uint32_t i = 0;
+    while (i < sizeof(sizes) / sizeof(sizes[0])) {
+        uint32_t size = sizes[i];
+        // 源缓冲区前size-1个字节非0，strlen的长度也为size-1；目的缓冲区与之相同，memcmp要比较到底
+        memset(bench_src, 'a', size - 1);
+        bench_src[size - 1] = 0;
+        memcpy(bench_dst, bench_src, size);
+        printk("%d  %d/%d  %d/%d  ", size,
+               bench_op(OP_MEMCPY, size, true), bench_op(OP_MEMCPY, size, false),
+               bench_op(OP_MEMSET, size, true), bench_op(OP_MEMSET, size, false));
+        memcpy(bench_dst, bench_src, size);
+        printk("%d/%d  %d/%d\n",
+               bench_op(OP_MEMCMP, size, true), bench_op(OP_MEMCMP, size, false),
+               bench_op(OP_STRLEN, size, true), bench_op(OP_STRLEN, size, false));
+        i++;
+    }
+}
+
+#define BENCH_IOQ_CHUNK 1024
+#define BENCH_IOQ_BYTES (64 * 1024)
+
+static struct ioqueue bench_queue;
+
+// 经过环形缓冲区传送BENCH_IOQ_BYTES字节，每次写入再读出BENCH_IOQ_CHUNK字节
+static uint32_t bench_ioq_op(bool bytewise) {
+    uint32_t done = 0, idx = 0;
+    uint64_t start = rdtsc();
+    while (done < BENCH_IOQ_BYTES) {
+        if (bytewise) {
+            for (idx = 0; idx < BENCH_IOQ_CHUNK; idx++) ioq_put_char(&bench_queue, bench_src[idx]);
+            for (idx = 0; idx < BENCH_IOQ_CHUNK; idx++) bench_dst[idx] = ioq_get_char(&bench_queue);
+        } else {
+            ioq_write_bulk(&bench_queue, bench_src, BENCH_IOQ_CHUNK);
+            ioq_read_bulk(&bench_queue, bench_dst, BENCH_IOQ_CHUNK);
+        }
+        done += BENCH_IOQ_CHUNK;
+    }
+    return (uint32_t)(rdtsc() - start);
+}
+
+// 管道缓冲区逐字节与整段拷贝的对照
+static void bench_ioq(void) {
+    ioqueue_init(&bench_queue);
+    enum intr_status old_status = intr_disable();
+    uint32_t bytewise = bench_ioq_op(true);
+    uint32_t bulk = bench_ioq_op(false);
+    intr_set_status(old_status);
+    printk("ioqueue cycles for %d bytes, byte/bulk: %d/%d\n", BENCH_IOQ_BYTES, bytewise, bulk);
+}
+
+#define BENCH_TOUCH_PAGES 64
+
+// 读低端1MB中的BENCH_TOUCH_PAGES页各一个字节，这些地址无论是否启用大页都已映射
+static void bench_touch(void) {
+    volatile uint8_t* addr = (volatile uint8_t*)K_DIRECT_BASE;
+    uint32_t idx = 0;
+    while (idx++ < BENCH_TOUCH_PAGES) {
+        (void)*addr;
+        addr += PG_SIZE;
+    }
+}
+
+// 切换页目录的开销：重新加载cr3后内核页的TLB项是否保留，以及相同页目录时跳过重新加载
+static void bench_tlb(void) {
+    uint32_t round = 0, cr3 = read_cr3();
+    uint64_t start;
+
+    bench_touch();
+    start = rdtsc();
+    while (round++ < BENCH_ROUNDS) bench_touch();
+    uint32_t warm = (uint32_t)(rdtsc() - start) / BENCH_ROUNDS;
+
+    round = 0;
+    start = rdtsc();
+    while (round++ < BENCH_ROUNDS) {
+        write_cr3(cr3);
+        bench_touch();
+    }
+    uint32_t reload = (uint32_t)(rdtsc() - start) / BENCH_ROUNDS;
+
+    round = 0;
+    start = rdtsc();
+    while (round++ < BENCH_ROUNDS) {
+        page_dir_activate(running_thread());
+        bench_touch();
+    }
+    uint32_t activate = (uint32_t)(rdtsc() - start) / BENCH_ROUNDS;
+
+    printk("tlb cycles, touch %d kernel pages: warm %d, after cr3 reload %d, after page_dir_activate %d\n",
+           BENCH_TOUCH_PAGES, warm, reload, activate);
+}
+
+// 在两个页目录之间来回切换，每次切换后访问内核页，相当于两个用户进程轮流运行时的内核部分
+static uint32_t bench_switch_op(uint32_t pgdir_a, uint32_t pgdir_b) {
+    uint32_t round = 0;
+    uint64_t start = rdtsc();
+    while (round++ < BENCH_ROUNDS) {
+        write_cr3(pgdir_a);
+        bench_touch();
+        write_cr3(pgdir_b);
+        bench_touch();
+    }
+    return (uint32_t)(rdtsc() - start) / (BENCH_ROUNDS * 2);
+}
+
+// 两个用户地址空间之间切换的开销，比较内核页是否为全局页
+static void bench_switch(void) {
+    uint32_t* pgdir_a = create_page_dir();
+    uint32_t* pgdir_b = create_page_dir();
+    if (pgdir_a == NULL || pgdir_b == NULL) {
+        printk("bench_switch: create_page_dir failed\n");
+        if (pgdir_a != NULL) mfree_page_locked(PF_KERNEL, pgdir_a, 1);
+        if (pgdir_b != NULL) mfree_page_locked(PF_KERNEL, pgdir_b, 1);
+        return;
+    }
+    uint32_t phy_a = addr_v2p((uint32_t)pgdir_a), phy_b = addr_v2p((uint32_t)pgdir_b);
+
+    // 关中断，免得计时期间被调度走时换回自己的页目录
+    enum intr_status old_status = intr_disable();
+    uint32_t cr3 = read_cr3(), cr4 = read_cr4();
+    bench_touch();
+    uint32_t global = bench_switch_op(phy_a, phy_b);
+    uint32_t nonglobal = global;
+    if (cr4 & CR4_PGE) {
+        // 关掉PGE后全局标志不起作用，每次切换都会丢掉内核页的TLB项
+        write_cr4(cr4 & ~CR4_PGE);
+        nonglobal = bench_switch_op(phy_a, phy_b);
+        write_cr4(cr4);
+    }
+    write_cr3(cr3);
+    intr_set_status(old_status);
+
+    mfree_page_locked(PF_KERNEL, pgdir_a, 1);
+    mfree_page_locked(PF_KERNEL, pgdir_b, 1);
+    printk("address space switch cycles, touch %d kernel pages: PGE %s %d, without PGE %d\n",
+           BENCH_TOUCH_PAGES, (cr4 & CR4_PGE) ? "on" : "unsupported", global, nonglobal);
+}
+
+void bench_run(void) {
+    bench_bitmap();
+    bench_string();
+    bench_ioq();
+    bench_tlb();
+    bench_switch();
+}
+# endif
@@ -2,28 +2,38 @@
 #include <kernel/interrupt.h>
 #include <device/timer.h>
 #include <kernel/memory.h>
+#include <kernel/slab.h>
 #include <kernel/thread.h>
 #include <device/console.h>
 #include <device/keyboard.h>
 #include <device/ide.h>
 #include <kernel/tss.h>
 #include <kernel/init.h>
+#include <kernel/string.h>
 #include <fs/fs.h>
+#include <fs/bcache.h>
+#include <user/pipe.h>
+#include <user/vdso-init.h>
 
 // extern int prog_a_pid, prog_b_pid;
 void init_all() {
     put_str("init_all.\n");
    
     idt_init();
+    string_sse2_enable(); // CPU支持时启用memcpy的SSE2路径
     mem_init();
+    slab_init();
     thread_init();
     timer_init();
     console_init();
     keyboard_init();
     tss_init();
     syscall_init();   // 初始化系统调用
+    vdso_init();      // 映射vDSO数据页
 
     intr_enable();    // 后面的ide_init需要打开中断
     ide_init();	      // 初始化硬盘
+    bcache_init();    // 初始化块缓存
     filesys_init();   // 初始化文件系统
+    pipe_init();      // 初始化管道缓冲区的cache
 }
@@ -4,6 +4,8 @@
 # include <kernel/interrupt.h>
 # include <lib/kernel/print.h>
 # include <kernel/debug.h>
+# include <kernel/memory.h>
+# include <user/exec.h>
 
 # define IDT_DESC_CNT 0x81 //目前支持的中断数
 # define PIC_M_CTRL 0x20
@@ -73,6 +75,21 @@ static void general_intr_handler(uint8_t vec_nr) {
     
 }
 
+/**
+ * 缺页异常处理，写时复制的页在这里复制，按需调页的页在这里调入，其余的按通用异常报错.
+ */
+static void page_fault_handler(uint8_t vec_nr) {
+    uint32_t page_fault_vaddr = 0;
+    asm ("movl %%cr2, %0" : "=r" (page_fault_vaddr));
+    // 大页映射的内核直接映射区总是存在的，在这里出错不是写时复制或按需调页
+    if (*pde_ptr(page_fault_vaddr) & PG_PS) {
+        general_intr_handler(vec_nr);
+        return;
+    }
+    if (cow_page_fault(page_fault_vaddr) || vma_page_fault(page_fault_vaddr)) return;
+    general_intr_handler(vec_nr);
+}
+
 /**
  * 通用(默认)的异常/中断处理器注册.
  */
@@ -82,6 +99,7 @@ static void exception_handler_init(void) {
         idt_table[i] = general_intr_handler;
         intr_name[i] = "unknown";
     }
+    idt_table[14] = page_fault_handler;
 
     init_custom_handler_name();
 }
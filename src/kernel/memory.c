@@ -6,6 +6,7 @@
 #include <kernel/sync.h>
 #include <device/console.h>
 #include <kernel/interrupt.h>
+#include <kernel/cpu.h>
 
 # define PG_SIZE 4096
 
@@ -22,17 +23,48 @@
 # define PTE_INDEX(addr) ((addr & 0x003ff000) >> 12) 
 
 
+// 伙伴系统的最大阶，最大的空闲块为 2^10 页即4MB
+# define MAX_ORDER 10
+# define FRAME_NIL 0xffff
+# define FRAME_FREE 1
+
+// 每个内存池预先清零的页框数，空闲页框少于 ZERO_POOL_RESERVE 时不再补充
+# define ZERO_POOL_SIZE 16
+# define ZERO_POOL_RESERVE 64
+
+// 物理页框的描述，空闲块只在首页框上记录阶并挂入该阶的空闲链表
+struct page_frame {
+    uint16_t next, prev;  // 空闲链表中前后空闲块首页框的下标
+    uint8_t order;        // 空闲块的阶
+    uint8_t flags;        // FRAME_FREE 表示是空闲块的首页框
+    uint16_t refs;        // 用户页框的引用计数，写时复制的父子进程共享同一页框时大于1
+};
+
 struct pool {
-    struct bitmap pool_bitmap;
+    struct bitmap pool_bitmap;  // 页框占用情况，只用于诊断，分配由伙伴系统完成
     uint32_t phy_addr_start;
     uint32_t pool_size;
 
-    struct lock lock; //申请内存的时候需要互斥
+    struct page_frame* frames;              // 每个页框一项
+    uint16_t free_head[MAX_ORDER + 1];      // 各阶空闲链表的表头
+    uint32_t free_pages;
+
+    uint32_t zero_frames[ZERO_POOL_SIZE];   // idle线程预先清零的页框，已从伙伴系统中分配出来
+    uint32_t zero_cnt;
+
+    struct lock lock; //申请和释放页框的调用者都要持有，保证引用计数与伙伴系统的判断一致
 };
 
 struct pool kernel_pool, user_pool;
 struct virtual_addr kernel_vaddr;
 
+// CPU支持PSE时内核内存池用4MB大页直接映射，内核页不再经过虚拟地址位图和页表
+static bool kernel_direct_map = false;
+static uint32_t direct_map_end;   // 直接映射的物理地址上界
+
+// 写时复制时暂存页内容的缓冲区，使用时持有 user_pool.lock
+static uint8_t cow_bounce[PG_SIZE];
+
 
 // 内存仓库 arena
 struct arena {
@@ -45,6 +77,131 @@ struct arena {
 struct mem_block_desc k_block_descs[DESC_CNT]; //内存块描述符数组
 
 
+static void frame_list_push(struct pool* m_pool, uint32_t idx, uint32_t order) {
+    struct page_frame* f = &m_pool->frames[idx];
+    f->order = order;
+    f->flags = FRAME_FREE;
+    f->prev = FRAME_NIL;
+    f->next = m_pool->free_head[order];
+    if (f->next != FRAME_NIL) m_pool->frames[f->next].prev = idx;
+    m_pool->free_head[order] = idx;
+}
+
+static void frame_list_remove(struct pool* m_pool, uint32_t idx) {
+    struct page_frame* f = &m_pool->frames[idx];
+    if (f->prev != FRAME_NIL) {
+        m_pool->frames[f->prev].next = f->next;
+    } else {
+        m_pool->free_head[f->order] = f->next;
+    }
+    if (f->next != FRAME_NIL) m_pool->frames[f->next].prev = f->prev;
+    f->flags = 0;
+}
+
+// 把[idx, idx + cnt)的页框拆成尽量大的对齐块放回空闲链表，调用者保证它们不会与伙伴合并
+static void buddy_add_range(struct pool* m_pool, uint32_t idx, uint32_t cnt) {
+    uint32_t end = idx + cnt;
+    while (idx < end) {
+        uint32_t order = MAX_ORDER;
+        while ((idx & ((1 << order) - 1)) || idx + (1 << order) > end) order--;
+        frame_list_push(m_pool, idx, order);
+        m_pool->free_pages += 1 << order;
+
+        uint32_t i = 0;
+        while (i < (1u << order)) bitmap_set(&m_pool->pool_bitmap, idx + i++, 0);
+        idx += 1 << order;
+    }
+}
+
+// 初始化内存池的伙伴系统，前reserved个页框已被占用
+static void buddy_init(struct pool* m_pool, struct page_frame* frames, uint32_t reserved) {
+    uint32_t order = 0, npages = m_pool->pool_size / PG_SIZE;
+    m_pool->frames = frames;
+    m_pool->free_pages = 0;
+    while (order <= MAX_ORDER) m_pool->free_head[order++] = FRAME_NIL;
+
+    uint32_t idx = 0;
+    while (idx < reserved) bitmap_set(&m_pool->pool_bitmap, idx++, 1);
+    buddy_add_range(m_pool, reserved, npages - reserved);
+}
+
+// 从伙伴系统中分配 2^order 个连续的页框，返回首页框的下标，失败返回-1
+static int32_t buddy_alloc(struct pool* m_pool, uint32_t order) {
+    uint32_t cur = order;
+    while (cur <= MAX_ORDER && m_pool->free_head[cur] == FRAME_NIL) cur++;
+    if (cur > MAX_ORDER) return -1;
+
+    uint32_t idx = m_pool->free_head[cur];
+    frame_list_remove(m_pool, idx);
+
+    // 大块对半拆分，后一半放回低一阶的空闲链表
+    while (cur > order) {
+        cur--;
+        frame_list_push(m_pool, idx + (1 << cur), cur);
+    }
+
+    uint32_t i = 0;
+    while (i < (1u << order)) bitmap_set(&m_pool->pool_bitmap, idx + i++, 1);
+    m_pool->free_pages -= 1 << order;
+    return idx;
+}
+
+// 释放一个页框，并逐阶与空闲的伙伴合并
+static void buddy_free(struct pool* m_pool, uint32_t idx) {
+    uint32_t order = 0, npages = m_pool->pool_size / PG_SIZE;
+    bitmap_set(&m_pool->pool_bitmap, idx, 0);
+    m_pool->free_pages++;
+
+    while (order < MAX_ORDER) {
+        uint32_t buddy = idx ^ (1 << order);
+        if (buddy + (1 << order) > npages) break;
+        struct page_frame* bf = &m_pool->frames[buddy];
+        if (!(bf->flags & FRAME_FREE) || bf->order != order) break;
+        frame_list_remove(m_pool, buddy);
+        idx &= ~(1 << order);
+        order++;
+    }
+    frame_list_push(m_pool, idx, order);
+}
+
+/* CPU支持PSE时，把物理地址[0, map_end)用4MB大页映射到 K_DIRECT_BASE 开始处，
+ * 替换loader为第768项起的页目录项建立的页表（第0项的低端1MB恒等映射不变）.
+ * 必须在创建任何进程之前调用，进程的页目录复制的是这里的内核页目录项 */
+static void direct_map_init(uint32_t map_end) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EDX_PSE)) {
+        put_str("    PSE not supported, kernel uses 4KB pages\n");
+        return;
+    }
+    write_cr4(read_cr4() | CR4_PSE);
+
+    uint32_t pde_cnt = DIV_ROUND_UP(map_end, 0x400000), idx = 0;
+    ASSERT(PDE_INDEX(K_DIRECT_BASE) + pde_cnt <= PDE_INDEX(KMAP_BASE));
+    uint32_t* pde = pde_ptr(K_DIRECT_BASE);
+    while (idx < pde_cnt) {
+        pde[idx] = (idx * 0x400000) | PG_PS | PG_US_U | PG_RW_W | PG_P_1;
+        idx++;
+    }
+    // 重新加载cr3刷新整个TLB
+    write_cr3(read_cr3());
+
+    /* 支持PGE时把直接映射标为全局页，切换进程重新加载cr3时这些TLB项保留.
+     * 只标记大页：loader的低端页表同时被第0项的恒等映射使用，不能标为全局 */
+    if (edx & CPUID_EDX_PGE) {
+        idx = 0;
+        while (idx < pde_cnt) pde[idx++] |= PG_G;
+        write_cr4(read_cr4() | CR4_PGE);   // 打开PGE会刷新整个TLB
+        put_str("    kernel direct map marked global\n");
+    }
+
+    kernel_direct_map = true;
+    direct_map_end = pde_cnt * 0x400000;
+    put_str("    kernel direct map with 4MB pages up to: ");
+    put_int(direct_map_end);
+    put_char('\n');
+}
+
 /**
  * 初始化内存池.
  */ 
@@ -111,6 +268,28 @@ static void mem_pool_init(uint32_t all_memory) {
     kernel_vaddr.vaddr_start = K_HEAP_START;
 
     bitmap_init(&kernel_vaddr.vaddr_bitmap);
+
+    // 内核内存池全部直接映射
+    direct_map_init(user_pool_start);
+
+    /* 两个内存池的页框描述数组放在内核内存池的开头，不用大页时映射到内核堆的起始处，
+     * 这些页框和虚拟页不再参与分配 */
+    uint32_t frame_pages = DIV_ROUND_UP((kernel_free_pages + user_free_pages) * sizeof(struct page_frame), PG_SIZE);
+    struct page_frame* frames = (struct page_frame*)(K_DIRECT_BASE + kernel_pool_start);
+    if (!kernel_direct_map) {
+        uint32_t idx = 0;
+        while (idx < frame_pages) {
+            page_table_set(K_HEAP_START + idx * PG_SIZE, \
+                           (kernel_pool_start + idx * PG_SIZE) | PG_US_U | PG_RW_W | PG_P_1);
+            bitmap_set(&kernel_vaddr.vaddr_bitmap, idx, 1);
+            idx++;
+        }
+        frames = (struct page_frame*)K_HEAP_START;
+    }
+    memset(frames, 0, frame_pages * PG_SIZE);
+
+    buddy_init(&kernel_pool, frames, frame_pages);
+    buddy_init(&user_pool, frames + kernel_free_pages, 0);
     put_str("Init memory pool done.\n");
 }
 
@@ -175,8 +354,10 @@ static void* vaddr_get(enum pool_flags pf, uint32_t pg_count) {
 
 /**
  * 得到虚拟地址对应的PTE的指针.
+ * 大页映射的地址没有页表，不能使用.
  */ 
 uint32_t* pte_ptr(uint32_t vaddr) {
+    ASSERT(!((*pde_ptr(vaddr) & (PG_PS | PG_P_1)) == (PG_PS | PG_P_1)));
     uint32_t* pte = (uint32_t*)(0xffc00000 + \
         ((vaddr & 0xffc00000) >> 10) + (PTE_INDEX(vaddr) * 4));
     return pte;
@@ -190,65 +371,128 @@ uint32_t* pde_ptr(uint32_t vaddr) {
     return pde;
 }
 
+/**
+ * 在给定的物理内存池中分配pg_cnt个物理地址连续的页，返回起始物理地址.
+ * 按2的幂向上取整后从伙伴系统分配，多出的尾部立即归还.
+ * 伙伴系统分配不出来时动用预先清零的页框池：单页直接从池中取，多页把池中的页框全部还回去再试一次.
+ * 调用者应持有内存池的锁；空闲链表的修改另外在关中断下进行，
+ * 不能睡眠的路径（如 thread_exit、idle线程）不持锁调用时链表也不会被改乱.
+ */
+static void* palloc_contig(struct pool* m_pool, uint32_t pg_cnt) {
+    uint32_t order = 0;
+    while ((1u << order) < pg_cnt) order++;
+    if (order > MAX_ORDER) return NULL;
+
+    enum intr_status old_status = intr_disable();
+    int32_t idx = buddy_alloc(m_pool, order);
+    if (idx == -1 && m_pool->zero_cnt > 0) {
+        if (pg_cnt == 1) {
+            // 池中的页框本来就是分配出去的，用户页框的引用计数也已是1
+            uint32_t pg_phy_addr = m_pool->zero_frames[--m_pool->zero_cnt];
+            intr_set_status(old_status);
+            return (void*)pg_phy_addr;
+        }
+        while (m_pool->zero_cnt > 0) {
+            buddy_free(m_pool, (m_pool->zero_frames[--m_pool->zero_cnt] - m_pool->phy_addr_start) / PG_SIZE);
+        }
+        idx = buddy_alloc(m_pool, order);
+    }
+    if (idx == -1) {
+        intr_set_status(old_status);
+        return NULL;
+    }
+    buddy_add_range(m_pool, idx + pg_cnt, (1 << order) - pg_cnt);
+
+    if (m_pool == &user_pool) {
+        uint32_t i = 0;
+        while (i < pg_cnt) m_pool->frames[idx + i++].refs = 1;
+    }
+    intr_set_status(old_status);
+    return (void*)(idx * PG_SIZE + m_pool->phy_addr_start);
+}
+
 /**
  * 在给定的物理内存池中分配一个物理页，返回其物理地址.
  */ 
 static void* palloc(struct pool* m_pool) {
-    int bit_index = bitmap_scan(&m_pool->pool_bitmap, 1);
-    if (bit_index == -1) {
-        return NULL;
-    }
-    bitmap_set(&m_pool->pool_bitmap, bit_index, 1);
-    uint32_t page_phyaddr = ((bit_index * PG_SIZE) + m_pool->phy_addr_start);
-    return (void*) page_phyaddr;
+    return palloc_contig(m_pool, 1);
+}
+
+// 从预先清零的页框池取一个页框，池空时返回0
+static uint32_t zero_frame_take(struct pool* m_pool) {
+    uint32_t pg_phy_addr = 0;
+    enum intr_status old_status = intr_disable();
+    if (m_pool->zero_cnt > 0) pg_phy_addr = m_pool->zero_frames[--m_pool->zero_cnt];
+    intr_set_status(old_status);
+    return pg_phy_addr;
+}
+
+// 用户页框的引用计数
+static uint16_t* frame_refs(uint32_t pg_phy_addr) {
+    return &user_pool.frames[(pg_phy_addr - user_pool.phy_addr_start) / PG_SIZE].refs;
 }
 
 /**
- * 通过页表建立虚拟页与物理页的映射关系.
+ * 在当前页表中把虚拟页vaddr的页表项设为pte，页表不存在时新分配一个.
  */ 
-static void page_table_add(void* _vaddr, void* _page_phyaddr) {
-    uint32_t vaddr = (uint32_t) _vaddr, page_phyaddr = (uint32_t) _page_phyaddr;
+void page_table_set(uint32_t vaddr, uint32_t pte_val) {
     uint32_t* pde = pde_ptr(vaddr); 
     uint32_t* pte = pte_ptr(vaddr);
-    
    
     if (*pde & 0x00000001) {
         // 页目录项已经存在
-  
         if (!(*pte & 0x00000001)) {
             // 物理页必定不存在，使页表项指向我们新分配的物理页
-            *pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
+            *pte = pte_val;
         } else {
             PANIC("pte repeat");
         }
     } else {
-        // 新分配一个物理页作为页表
-        uint32_t pde_phyaddr = (uint32_t) palloc(&kernel_pool);
+        // 新分配一个物理页作为页表，优先用预先清零的页框
+        uint32_t pde_phyaddr = zero_frame_take(&kernel_pool);
+        bool zeroed = pde_phyaddr != 0;
+        if (!zeroed) {
+            // 调用者持有的可能是用户内存池的锁，页表来自内核内存池
+            lock_acquire(&kernel_pool.lock);
+            pde_phyaddr = (uint32_t) palloc(&kernel_pool);
+            lock_release(&kernel_pool.lock);
+        }
         *pde = (pde_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
         // 清理物理页
-        // ASSERT(3== 2);
-        memset((void*)((int)pte & 0xfffff000), 0, PG_SIZE);  
-        // ASSERT(3== 2);
+        if (!zeroed) memset((void*)((int)pte & 0xfffff000), 0, PG_SIZE);
         ASSERT(!(*pte & 0x00000001));
-        // ASSERT(3== 2);
-        *pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
-        // ASSERT(1 == 2);
+        *pte = pte_val;
     }
-     if(vaddr == (0xc0000000 - 0x1000)){
+}
 
-    // ASSERT(1 == 2);
-    }
+/**
+ * 通过页表建立虚拟页与物理页的映射关系.
+ */ 
+static void page_table_add(void* _vaddr, void* _page_phyaddr) {
+    page_table_set((uint32_t)_vaddr, (uint32_t)_page_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
 }
 
 
 /**
  * 分配page_count个页空间，自动建立虚拟页与物理页的映射.
+ * pf 带 PF_ZERO 时页的内容为0，单页优先取预先清零的页框.
  */ 
 void* malloc_page(enum pool_flags pf, uint32_t page_count) {
     ASSERT(page_count > 0 && page_count < 3840);
 
+    // 直接映射时内核页必须物理连续，虚拟地址由物理地址得到
+    if ((pf & PF_KERNEL) && kernel_direct_map) {
+        uint32_t page_phyaddr = (pf & PF_ZERO) && page_count == 1 ? zero_frame_take(&kernel_pool) : 0;
+        if (page_phyaddr != 0) return (void*)(K_DIRECT_BASE + page_phyaddr);
+        page_phyaddr = (uint32_t) palloc_contig(&kernel_pool, page_count);
+        if (page_phyaddr == 0) return NULL;
+        void* vaddr_start = (void*)(K_DIRECT_BASE + page_phyaddr);
+        if (pf & PF_ZERO) memset(vaddr_start, 0, page_count * PG_SIZE);
+        return vaddr_start;
+    }
+
     // 在虚拟地址池中申请虚拟内存
-    void* vaddr_start = vaddr_get(pf, page_count);
+    void* vaddr_start = vaddr_get(pf & ~PF_ZERO, page_count);
   
     if (vaddr_start == NULL) {
         return NULL;
@@ -257,7 +501,28 @@ void* malloc_page(enum pool_flags pf, uint32_t page_count) {
     uint32_t vaddr = (uint32_t) vaddr_start, count = page_count;
     struct pool* mem_pool = (pf & PF_KERNEL) ? &kernel_pool : &user_pool;
 
-    // 物理页不必连续，逐个与虚拟页做映射
+    if ((pf & PF_ZERO) && page_count == 1) {
+        uint32_t zero_phyaddr = zero_frame_take(mem_pool);
+        if (zero_phyaddr != 0) {
+            page_table_add(vaddr_start, (void*) zero_phyaddr);
+            return vaddr_start;
+        }
+    }
+
+    // 优先使用物理连续的页框
+    uint32_t page_phyaddr = (uint32_t) palloc_contig(mem_pool, page_count);
+    if (page_phyaddr != 0) {
+        while (count > 0) {
+            page_table_add((void*) vaddr, (void*) page_phyaddr);
+            vaddr += PG_SIZE;
+            page_phyaddr += PG_SIZE;
+            --count;
+        }
+        if (pf & PF_ZERO) memset(vaddr_start, 0, page_count * PG_SIZE);
+        return vaddr_start;
+    }
+
+    // 没有足够大的连续块时物理页不必连续，逐个与虚拟页做映射
     while (count > 0) {
         void* page_phyaddr = palloc(mem_pool);
         if (page_phyaddr == NULL) {
@@ -269,6 +534,7 @@ void* malloc_page(enum pool_flags pf, uint32_t page_count) {
         --count;
     }
 
+    if (pf & PF_ZERO) memset(vaddr_start, 0, page_count * PG_SIZE);
     return vaddr_start;
 }
 
@@ -277,10 +543,7 @@ void* malloc_page(enum pool_flags pf, uint32_t page_count) {
  */ 
 void* get_kernel_pages(uint32_t page_count) {
     lock_acquire(&kernel_pool.lock);
-    void* vaddr = malloc_page(PF_KERNEL, page_count);
-    if (vaddr != NULL) {
-        memset(vaddr, 0, page_count * PG_SIZE);
-    }
+    void* vaddr = malloc_page(PF_KERNEL | PF_ZERO, page_count);
     lock_release(&kernel_pool.lock);
     return vaddr;
 }
@@ -291,10 +554,7 @@ void* get_kernel_pages(uint32_t page_count) {
  */
 void* get_user_pages(uint32_t page_count) {
     lock_acquire(&user_pool.lock);//加锁
-    void* vaddr = malloc_page(PF_USER, page_count);
-    if (vaddr != NULL) {
-        memset(vaddr, 0, page_count * PG_SIZE);
-    }
+    void* vaddr = malloc_page(PF_USER | PF_ZERO, page_count);
     lock_release(&user_pool.lock);
     return vaddr;
 }
@@ -324,7 +584,10 @@ void* get_a_page(enum pool_flags pf, uint32_t vaddr) {
     }
 
     void* page_phyaddr = palloc(mem_pool); //在给定的物理内存池中分配一页物理地址
-    if (page_phyaddr == NULL) return NULL;
+    if (page_phyaddr == NULL) {
+        lock_release(&mem_pool->lock);
+        return NULL;
+    }
     
     page_table_add((void*)vaddr, page_phyaddr);
 //   ASSERT(1 == 2);
@@ -337,6 +600,10 @@ void* get_a_page(enum pool_flags pf, uint32_t vaddr) {
  * 返回该虚拟地址映射到的物理地址
  */
 uint32_t addr_v2p(uint32_t vaddr) {
+    uint32_t pde = *pde_ptr(vaddr);
+    if ((pde & (PG_PS | PG_P_1)) == (PG_PS | PG_P_1)) {
+        return (pde & 0xffc00000) + (vaddr & 0x003fffff);
+    }
 
     uint32_t* pte = pte_ptr(vaddr);
 
@@ -352,6 +619,7 @@ void block_desc_init(struct mem_block_desc* desc_array) {
         desc_array[index].block_size = block_size;
         desc_array[index].block_per_arena = (PG_SIZE - sizeof(struct arena)) / block_size;
         list_init(&desc_array[index].free_list);
+        desc_array[index].mag_cnt = 0;
 
         block_size *= 2;
     }
@@ -371,117 +639,129 @@ static struct arena* block2arena(struct mem_block* b) {
     return (struct arena*)((uint32_t)b & 0xfffff000);
 }
 
-//申请 size 字节的内存
-void* sys_malloc(uint32_t size) {
-    
-    enum pool_flags PF;
-    struct pool* mem_pool;
-    uint32_t pool_size;
-    struct mem_block_desc* descs;
+// 当前任务使用的内存池和内存块描述符，内核线程使用内核的，用户进程使用自己的
+static enum pool_flags heap_select(struct pool** mem_pool, struct mem_block_desc** descs) {
     struct task_struct* cur_thread = running_thread();
-
     if (cur_thread->pgdir == NULL) { //内核线程
-        PF = PF_KERNEL;
-        // console_put_str("kernel");
-        mem_pool = &kernel_pool;
-        pool_size = kernel_pool.pool_size;
-        descs = k_block_descs;
-    } else { //用户进程
-        PF = PF_USER;
-        // console_put_str("user");
-        mem_pool = &user_pool;
-        pool_size = user_pool.pool_size;
-        descs = cur_thread->u_block_desc;
+        *mem_pool = &kernel_pool;
+        *descs = k_block_descs;
+        return PF_KERNEL;
     }
+    *mem_pool = &user_pool;
+    *descs = cur_thread->u_block_desc;
+    return PF_USER;
+}
 
-    if (!(size > 0 && size < pool_size)) return NULL;
-
+// 从描述符 desc 的空闲链表取最多 MAG_BATCH 个块装入弹匣，链表空时新建 arena，调用者持有内存池的锁
+static bool mag_refill(enum pool_flags PF, struct mem_block_desc* desc) {
     struct arena* a;
     struct mem_block* b;
 
-    lock_acquire(&mem_pool->lock);
-
-    if (size > 1024) { //申请的内存超过1024，将整页分配出去
-        uint32_t page_cnt = DIV_ROUND_UP(size + sizeof(struct arena), PG_SIZE); //需要的页框数
-        a = malloc_page(PF, page_cnt);
-        
-        if (a != NULL) {
-            memset(a, 0, page_cnt * PG_SIZE);
+    // 如果没有可用的内存块，就创建新的 arena 并为它分配内存块
+    if (list_empty(&desc->free_list)) {
+        a = malloc_page(PF, 1);
+        if (a == NULL) return false;
+
+        a->desc = desc;
+        a->large = false;
+        a->cnt = desc->block_per_arena;
+
+        //将 arena 拆分为内存块，加入空闲内存块链表中
+        uint32_t block_idx;
+        enum intr_status old_status = intr_disable();
+        for (block_idx = 0; block_idx < desc->block_per_arena; block_idx++) {
+            b = arena2block(a, block_idx);
+            list_append(&desc->free_list, &b->free_elem);
+        }
+        intr_set_status(old_status);
+    }
 
-            // 内存块描述符表为空，large 为 true，cnt 表示需要的页框数
-            a->desc = NULL;
-            a->cnt = page_cnt;
-            a->large = true;
+    enum intr_status old_status = intr_disable();
+    uint32_t cnt = 0;
+    while (cnt < MAG_BATCH && desc->mag_cnt < MAG_SIZE && !list_empty(&desc->free_list)) {
+        b = elem2entry(struct mem_block, free_elem, list_pop(&desc->free_list)); //获取内存块地址
+        block2arena(b)->cnt--;
+        desc->mag[desc->mag_cnt++] = b;
+        cnt++;
+    }
+    intr_set_status(old_status);
+    return true;
+}
 
-            lock_release(&mem_pool->lock);
-            return (void*)(a + 1); //跨过元信息部分，返回 arena 中的内存池起始地址
-        } else {
-            lock_release(&mem_pool->lock);
-            return NULL;
-        }
-    } else { 
-        //找到适合的内存块大小
-        uint32_t desc_idx;
-        for (desc_idx = 0; desc_idx < DESC_CNT; desc_idx++) {
-            if (size <= descs[desc_idx].block_size) break;
-        }
+// 申请 size 字节的内存，zero 为 true 时清零
+static void* heap_alloc(uint32_t size, bool zero) {
+    struct pool* mem_pool;
+    struct mem_block_desc* descs;
+    enum pool_flags PF = heap_select(&mem_pool, &descs);
 
-        // 如果没有可用的内存块，就创建新的 arena 并为它分配内存块
-        if (list_empty(&descs[desc_idx].free_list)) {
-            a = malloc_page(PF, 1);
-            if (a == NULL) {
-                lock_release(&mem_pool->lock);
-                return NULL;
-            }
+    if (!(size > 0 && size < mem_pool->pool_size)) return NULL;
 
-            memset(a, 0, PG_SIZE);
-            a->desc = &descs[desc_idx];
-            a->large = false;
-            a->cnt = descs[desc_idx].block_per_arena;
+    struct arena* a;
+    struct mem_block* b;
 
-            //将 arena 拆分为内存块，加入空闲内存块链表中
-            uint32_t block_idx;
-            enum intr_status old_status = intr_disable();
-            for (block_idx = 0; block_idx < descs[desc_idx].block_per_arena; block_idx++) {
-                b = arena2block(a, block_idx);
-                ASSERT(!elem_find(&a->desc->free_list, &b->free_elem));
-                list_append(&a->desc->free_list, &b->free_elem);
-            }
+    if (size > 1024) { //申请的内存超过1024，将整页分配出去
+        lock_acquire(&mem_pool->lock);
+        uint32_t page_cnt = DIV_ROUND_UP(size + sizeof(struct arena), PG_SIZE); //需要的页框数
+        a = malloc_page(zero ? PF | PF_ZERO : PF, page_cnt);
+        lock_release(&mem_pool->lock);
+        if (a == NULL) return NULL;
 
-            intr_set_status(old_status);
-        }
+        // 内存块描述符表为空，large 为 true，cnt 表示需要的页框数
+        a->desc = NULL;
+        a->cnt = page_cnt;
+        a->large = true;
+        return (void*)(a + 1); //跨过元信息部分，返回 arena 中的内存池起始地址
+    }
 
-        //分配内存块
-        b = elem2entry(struct mem_block, free_elem, list_pop(&descs[desc_idx].free_list)); //获取内存块地址
-        
-        memset(b, 0, descs[desc_idx].block_size);
-        a = block2arena(b); //获取内存块 b 所在的 arena 地址
-        a->cnt--;
-        
+    //找到适合的内存块大小
+    uint32_t desc_idx;
+    for (desc_idx = 0; desc_idx < DESC_CNT; desc_idx++) {
+        if (size <= descs[desc_idx].block_size) break;
+    }
+    struct mem_block_desc* desc = &descs[desc_idx];
+
+    // 先从弹匣里取，弹匣空了再持锁从空闲链表成批装填
+    enum intr_status old_status = intr_disable();
+    while (desc->mag_cnt == 0) {
+        intr_set_status(old_status);
+        lock_acquire(&mem_pool->lock);
+        bool ok = mag_refill(PF, desc);
         lock_release(&mem_pool->lock);
-        // console_put_int((uint32_t)b);
-        return (void*)b;
+        if (!ok) return NULL;
+        old_status = intr_disable();
     }
+    b = desc->mag[--desc->mag_cnt];
+    intr_set_status(old_status);
 
+    if (zero) memset(b, 0, desc->block_size);
+    return (void*)b;
+}
 
+//申请 size 字节的内存，内容清零
+void* sys_malloc(uint32_t size) {
+    return heap_alloc(size, true);
+}
+
+// 申请 size 字节的内存，不清零，用于马上会被整体覆盖的缓冲区
+void* sys_malloc_nozero(uint32_t size) {
+    return heap_alloc(size, false);
 }
 
 /**
  * 释放内存
  */
-//在物理地址池中释放物理页地址
+//在物理地址池中释放物理页地址，调用者应持有所属内存池的锁，减引用和归还伙伴系统在关中断下一起完成
 void pfree(uint32_t pg_phy_addr) {
-    struct pool* mem_pool;
-    uint32_t bm_idx = 0;
-    if (pg_phy_addr > user_pool.phy_addr_start) {  //用户的物理内存池
-        mem_pool = &user_pool;
-        bm_idx = (pg_phy_addr - user_pool.phy_addr_start) / PG_SIZE;
+    enum intr_status old_status = intr_disable();
+    if (pg_phy_addr >= user_pool.phy_addr_start) {  //用户的物理内存池
+        // 还有其他进程共享该页框时只减少引用
+        if (--*frame_refs(pg_phy_addr) == 0) {
+            buddy_free(&user_pool, (pg_phy_addr - user_pool.phy_addr_start) / PG_SIZE);
+        }
     } else {                                       //内核的物理内存池
-        mem_pool = &kernel_pool;
-        bm_idx = (pg_phy_addr- kernel_pool.phy_addr_start) / PG_SIZE;
+        buddy_free(&kernel_pool, (pg_phy_addr - kernel_pool.phy_addr_start) / PG_SIZE);
     }
-
-    bitmap_set(&mem_pool->pool_bitmap, bm_idx, 0);
+    intr_set_status(old_status);
 }
 
 // 在页表中去掉虚拟地址的映射
@@ -489,7 +769,7 @@ static void page_table_pte_remove(uint32_t vaddr) {
     uint32_t* pte = pte_ptr(vaddr);
 
     *pte &=  ~PG_P_1;  //将虚拟地址对应 pte 的 P 位置 0
-    asm volatile ("invlpg %0": : "m" (vaddr): "memory"); //刷新快表 tlb
+    invlpg(vaddr); //刷新快表 tlb
 }
 
 //在虚拟地址池中释放虚拟地址，释放以_vaddr 起始的连续 pg_cnt 个虚拟页地址
@@ -543,80 +823,278 @@ void mfree_page(enum pool_flags pf, void* _vaddr, uint32_t pg_cnt) {
             pg_phy_addr >= kernel_pool.phy_addr_start);
 
             pfree(pg_phy_addr);
-            page_table_pte_remove(vaddr);
+            if (!kernel_direct_map) page_table_pte_remove(vaddr);
             cnt++;
         }
-        vaddr_remove(pf, _vaddr, pg_cnt);
+        if (!kernel_direct_map) vaddr_remove(pf, _vaddr, pg_cnt);
     }
 }
 
-// 释放或回收 ptr 所指向的内存
-void sys_free(void* ptr) {
-    ASSERT(ptr != NULL);
+// 持有所属内存池的锁释放以虚拟地址 vaddr 为起始的 cnt 个页，供没有持锁的调用者使用
+void mfree_page_locked(enum pool_flags pf, void* _vaddr, uint32_t pg_cnt) {
+    struct pool* mem_pool = pf == PF_KERNEL ? &kernel_pool : &user_pool;
+    lock_acquire(&mem_pool->lock);
+    mfree_page(pf, _vaddr, pg_cnt);
+    lock_release(&mem_pool->lock);
+}
 
-    enum pool_flags pf;
-    struct pool* mem_pool;
+/**
+ * 在内核内存池中申请pg_cnt个物理地址连续的页（如DMA缓冲区），物理地址由addr_v2p得到，
+ * 用mfree_page_locked(PF_KERNEL, ...)释放.
+ */
+void* get_kernel_pages_contig(uint32_t pg_cnt) {
+    // 直接映射时内核页本来就是物理连续的
+    if (kernel_direct_map) return get_kernel_pages(pg_cnt);
 
-    if(running_thread()->pgdir == NULL) {
-        pf = PF_KERNEL;
-        mem_pool = &kernel_pool;
-    } else {
-        pf = PF_USER;
-        mem_pool = &user_pool;
+    lock_acquire(&kernel_pool.lock);
+    void* vaddr_start = vaddr_get(PF_KERNEL, pg_cnt);
+    if (vaddr_start == NULL) {
+        lock_release(&kernel_pool.lock);
+        return NULL;
+    }
+    uint32_t page_phyaddr = (uint32_t) palloc_contig(&kernel_pool, pg_cnt);
+    if (page_phyaddr == 0) {
+        vaddr_remove(PF_KERNEL, vaddr_start, pg_cnt);
+        lock_release(&kernel_pool.lock);
+        return NULL;
     }
 
-    lock_acquire(&mem_pool->lock);
+    uint32_t vaddr = (uint32_t) vaddr_start, cnt = 0;
+    while (cnt++ < pg_cnt) {
+        page_table_add((void*) vaddr, (void*) page_phyaddr);
+        vaddr += PG_SIZE;
+        page_phyaddr += PG_SIZE;
+    }
+    memset(vaddr_start, 0, pg_cnt * PG_SIZE);
+    lock_release(&kernel_pool.lock);
+    return vaddr_start;
+}
 
-    struct mem_block* b = ptr;
-    struct arena* a = block2arena(b);
-    ASSERT(a->large == 0 || a->large == 1);
+// 把弹匣中最早放入的 MAG_BATCH 个块还给空闲链表，arena 全部空闲时释放它，调用者持有内存池的锁
+static void mag_drain(enum pool_flags pf, struct mem_block_desc* desc) {
+    enum intr_status old_status = intr_disable();
+    uint32_t cnt = desc->mag_cnt < MAG_BATCH ? desc->mag_cnt : MAG_BATCH;
+    struct mem_block* drained[MAG_BATCH];
+    uint32_t idx = 0;
+    while (idx < cnt) {
+        drained[idx] = desc->mag[idx];
+        idx++;
+    }
+    for (idx = cnt; idx < desc->mag_cnt; idx++) desc->mag[idx - cnt] = desc->mag[idx];
+    desc->mag_cnt -= cnt;
+    intr_set_status(old_status);
 
-    if (a->large == 1 && a->desc == NULL) { //释放大于 1024 字节的大内存
-        mfree_page(pf, a, a->cnt);
-    } else {
-        list_append(&a->desc->free_list, &b->free_elem); //回收小内存块
+    for (idx = 0; idx < cnt; idx++) {
+        struct mem_block* b = drained[idx];
+        struct arena* a = block2arena(b);
+        list_append(&desc->free_list, &b->free_elem); //回收小内存块
 
-        if (++a->cnt == a->desc->block_per_arena) { //如果该 arena 已经没人使用就释放
-            for (uint32_t block_idx = 0; block_idx < a->desc->block_per_arena; block_idx++) {
-                struct mem_block* b = arena2block(a, block_idx);
-                ASSERT(elem_find(&a->desc->free_list, &b->free_elem));
-                list_remove(&b->free_elem);
+        if (++a->cnt == desc->block_per_arena) { //如果该 arena 已经没人使用就释放
+            // arena 的块都在空闲链表中，直接逐个摘下
+            uint32_t block_idx;
+            for (block_idx = 0; block_idx < desc->block_per_arena; block_idx++) {
+                list_remove(&arena2block(a, block_idx)->free_elem);
             }
-
             mfree_page(pf, a, 1);
         }
     }
+}
 
-    lock_release(&mem_pool->lock);
+// 释放或回收 ptr 所指向的内存
+void sys_free(void* ptr) {
+    ASSERT(ptr != NULL);
+
+    struct mem_block* b = ptr;
+    struct arena* a = block2arena(b);
+    ASSERT(a->large == 0 || a->large == 1);
+
+    // 按块所在的地址而不是当前任务选择内存池，内核线程借用户进程上下文释放内核块时也能正确回收
+    enum pool_flags pf = (uint32_t)a >= 0xc0000000 ? PF_KERNEL : PF_USER;
+    struct pool* mem_pool = pf == PF_KERNEL ? &kernel_pool : &user_pool;
+
+    if (a->large == 1 && a->desc == NULL) { //释放大于 1024 字节的大内存
+        mfree_page_locked(pf, a, a->cnt);
+        return;
+    }
+
+    // 小内存块先放回弹匣，弹匣满了再持锁把一批块还给空闲链表
+    struct mem_block_desc* desc = a->desc;
+    enum intr_status old_status = intr_disable();
+    while (desc->mag_cnt == MAG_SIZE) {
+        intr_set_status(old_status);
+        lock_acquire(&mem_pool->lock);
+        mag_drain(pf, desc);
+        lock_release(&mem_pool->lock);
+        old_status = intr_disable();
+    }
+    desc->mag[desc->mag_cnt++] = b;
+    intr_set_status(old_status);
 }
 
 
-// 安装一页大小的vaddr，但是不需要在虚拟地址内存池中设置位图
+// 安装一页大小的vaddr，但是不需要在虚拟地址内存池中设置位图，pf 带 PF_ZERO 时页的内容为0
 void* get_a_page_without_opvaddrbitmap(enum pool_flags pf, uint32_t vaddr) {
     struct pool* mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
     lock_acquire(&mem_pool->lock);
-    void* page_phyaddr = palloc(mem_pool);
+    void* page_phyaddr = (pf & PF_ZERO) ? (void*) zero_frame_take(mem_pool) : NULL;
+    bool zeroed = page_phyaddr != NULL;
+    if (!zeroed) page_phyaddr = palloc(mem_pool);
     if (page_phyaddr == NULL) {
         lock_release(&mem_pool->lock);
         return NULL;
     }
     page_table_add((void*)vaddr, page_phyaddr);
+    if ((pf & PF_ZERO) && !zeroed) memset((void*)vaddr, 0, PG_SIZE);
     lock_release(&mem_pool->lock);
     return (void*)vaddr;
 }
 
+// 把物理页框映射到临时窗口的第slot页，返回其虚拟地址，同一窗口同时只能有一个使用者
+void* kmap(uint32_t slot, uint32_t pg_phy_addr) {
+    ASSERT(slot < KMAP_SLOTS);
+    // 直接映射区内的页框不需要临时映射
+    if (pg_phy_addr < direct_map_end) return (void*)(K_DIRECT_BASE + pg_phy_addr);
+
+    uint32_t vaddr = KMAP_BASE + slot * PG_SIZE;
+    *pte_ptr(vaddr) = pg_phy_addr | PG_US_S | PG_RW_W | PG_P_1;
+    invlpg(vaddr);
+    return (void*) vaddr;
+}
+
+void kunmap(uint32_t slot) {
+    uint32_t vaddr = KMAP_BASE + slot * PG_SIZE;
+    uint32_t* pte = pte_ptr(vaddr);
+    // 直接映射时kmap没有使用窗口
+    if (*pte == 0) return;
+    *pte = 0;
+    invlpg(vaddr);
+}
+
+/* 在另一个地址空间pgdir中把vaddr的页表项设为pte_val，页表不存在时新分配一个.
+ * 通过临时映射访问它的页表，不用切换cr3 */
+void page_table_set_in(uint32_t* pgdir, uint32_t vaddr, uint32_t pte_val) {
+    lock_acquire(&kernel_pool.lock);
+    uint32_t* pde = &pgdir[PDE_INDEX(vaddr)];
+    if (!(*pde & PG_P_1)) {
+        uint32_t pt_phyaddr = zero_frame_take(&kernel_pool);
+        bool zeroed = pt_phyaddr != 0;
+        if (!zeroed) pt_phyaddr = (uint32_t) palloc(&kernel_pool);
+        ASSERT(pt_phyaddr != 0);
+        if (!zeroed) {
+            memset(kmap(KMAP_PGTABLE, pt_phyaddr), 0, PG_SIZE);
+            kunmap(KMAP_PGTABLE);
+        }
+        *pde = pt_phyaddr | PG_US_U | PG_RW_W | PG_P_1;
+    }
+
+    uint32_t* pte = (uint32_t*)kmap(KMAP_PGTABLE, *pde & 0xfffff000) + PTE_INDEX(vaddr);
+    ASSERT(!(*pte & PG_P_1));
+    *pte = pte_val;
+    kunmap(KMAP_PGTABLE);
+    lock_release(&kernel_pool.lock);
+}
+
+/* 清零一个页框放入预先清零的页框池，先补内核池再补用户池，补充了返回true.
+ * 由idle线程调用，不能在锁上睡眠：内存池的锁被其他任务占用时本次放弃，不和它争剩下的页框。
+ * 分配本身在关中断下完成，不依赖这把锁；清零期间可以被中断和抢占 */
+bool zero_pool_refill(void) {
+    struct pool* m_pool = kernel_pool.zero_cnt < ZERO_POOL_SIZE ? &kernel_pool : &user_pool;
+    enum intr_status old_status = intr_disable();
+    if (m_pool->zero_cnt == ZERO_POOL_SIZE || m_pool->lock.holder != NULL || \
+        m_pool->free_pages < ZERO_POOL_RESERVE) {
+        intr_set_status(old_status);
+        return false;
+    }
+    uint32_t pg_phy_addr = (uint32_t) palloc(m_pool);
+    intr_set_status(old_status);
+    if (pg_phy_addr == 0) return false;
+
+    memset(kmap(KMAP_ZERO, pg_phy_addr), 0, PG_SIZE);
+    kunmap(KMAP_ZERO);
+
+    old_status = intr_disable();
+    m_pool->zero_frames[m_pool->zero_cnt++] = pg_phy_addr;
+    intr_set_status(old_status);
+    return true;
+}
+
 // 根据物理页框地址将相应的内存池位图清0 但不改动页表
 void free_a_phy_page(uint32_t pg_phy_addr) {
-   struct pool* mem_pool;
-   uint32_t bit_idx = 0;
-   if (pg_phy_addr >= user_pool.phy_addr_start) {
-      mem_pool = &user_pool;
-      bit_idx = (pg_phy_addr - user_pool.phy_addr_start) / PG_SIZE;
-   } else {
-      mem_pool = &kernel_pool;
-      bit_idx = (pg_phy_addr - kernel_pool.phy_addr_start) / PG_SIZE;
-   }
-   bitmap_set(mem_pool, bit_idx, 0);
+   struct pool* mem_pool = pg_phy_addr >= user_pool.phy_addr_start ? &user_pool : &kernel_pool;
+   lock_acquire(&mem_pool->lock);
+   pfree(pg_phy_addr);
+   lock_release(&mem_pool->lock);
+}
+
+// 解除当前进程用户虚拟页vaddr的映射并释放页框（共享的页框只减少引用），不改动虚拟地址位图
+void user_page_unmap(uint32_t vaddr) {
+    uint32_t* pde = pde_ptr(vaddr);
+    if (!(*pde & PG_P_1)) return;
+    uint32_t* pte = pte_ptr(vaddr);
+    if (!(*pte & PG_P_1)) return;
+
+    lock_acquire(&user_pool.lock);
+    pfree(*pte & 0xfffff000);
+    *pte &= ~PG_P_1;
+    invlpg(vaddr);
+    lock_release(&user_pool.lock);
+}
+
+/* fork 时共享当前进程虚拟页vaddr的页框：可写的页改为只读并打上写时复制标记，页框引用加1，
+ * 返回子进程中应安装的页表项，页不存在时返回0 */
+uint32_t cow_share_page(uint32_t vaddr) {
+    uint32_t* pde = pde_ptr(vaddr);
+    if (!(*pde & PG_P_1)) return 0;
+    uint32_t* pte = pte_ptr(vaddr);
+    if (!(*pte & PG_P_1)) return 0;
+
+    lock_acquire(&user_pool.lock);
+    uint32_t pg_phy_addr = *pte & 0xfffff000;
+    ASSERT(pg_phy_addr >= user_pool.phy_addr_start);
+    if (*pte & PG_RW_W) {
+        *pte = (*pte & ~PG_RW_W) | PG_COW;
+        invlpg(vaddr);
+    }
+    (*frame_refs(pg_phy_addr))++;
+    lock_release(&user_pool.lock);
+    return *pte;
+}
+
+/* 缺页异常中处理对写时复制页的写，处理了返回true。
+ * 页框只剩自己引用时直接恢复可写，否则复制一份新的页框 */
+bool cow_page_fault(uint32_t vaddr) {
+    if (vaddr >= 0xc0000000) return false;
+    lock_acquire(&user_pool.lock);
+
+    uint32_t* pde = pde_ptr(vaddr);
+    uint32_t* pte = pte_ptr(vaddr);
+    if (!(*pde & PG_P_1) || (*pte & (PG_P_1 | PG_COW)) != (PG_P_1 | PG_COW)) {
+        lock_release(&user_pool.lock);
+        return false;
+    }
+
+    uint32_t page_vaddr = vaddr & 0xfffff000;
+    uint32_t pg_phy_addr = *pte & 0xfffff000;
+    uint16_t* refs = frame_refs(pg_phy_addr);
+    if (*refs == 1) {
+        *pte = (*pte | PG_RW_W) & ~PG_COW;
+        invlpg(page_vaddr);
+    } else {
+        void* new_phyaddr = palloc(&user_pool);
+        if (new_phyaddr == NULL) {
+            lock_release(&user_pool.lock);
+            return false;
+        }
+        // 新页框没有内核虚拟地址，先借缓冲区中转，换掉页表项后再写回原来的虚拟地址
+        memcpy(cow_bounce, (void*)page_vaddr, PG_SIZE);
+        (*refs)--;
+        *pte = (uint32_t)new_phyaddr | (*pte & 0x00000fff & ~PG_COW) | PG_RW_W;
+        invlpg(page_vaddr);
+        memcpy((void*)page_vaddr, cow_bounce, PG_SIZE);
+    }
+
+    lock_release(&user_pool.lock);
+    return true;
 }
 
 void mem_init(void) {
@@ -624,5 +1102,10 @@ void mem_init(void) {
     uint32_t total_memory = (*(uint32_t*) (0xb00));
     mem_pool_init(total_memory);
     block_desc_init(k_block_descs);
+
+    // 打开 CR0.WP，内核写只读的用户页时也触发缺页异常，写时复制才对 sys_read 等内核写入生效
+    uint32_t cr0;
+    asm volatile ("movl %%cr0, %0" : "=r" (cr0));
+    asm volatile ("movl %0, %%cr0" : : "r" (cr0 | 0x10000) : "memory");
     put_str("Init memory done.\n");
 }
@@ -0,0 +1,165 @@
+#include <kernel/slab.h>
+#include <kernel/memory.h>
+#include <kernel/string.h>
+#include <kernel/debug.h>
+#include <kernel/global.h>
+#include <lib/kernel/print.h>
+#include <lib/kernel/stdio-kernel.h>
+
+#define SLAB_EMPTY_KEEP 1   // 每个cache最多保留的空slab数，多余的归还内存池
+
+// 存放kmem_cache结构体本身的cache
+static struct kmem_cache cache_cache;
+
+// 由对象地址找到所属的slab
+static inline struct slab* obj2slab(void* obj) {
+    return (struct slab*)((uint32_t)obj & 0xfffff000);
+}
+
+static inline void* slab_obj(struct kmem_cache* cache, struct slab* slab, uint32_t idx) {
+    return (void*)((uint32_t)slab + cache->obj_offset + idx * cache->obj_size);
+}
+
+static void cache_setup(struct kmem_cache* cache, const char* name, uint32_t obj_size, \
+                        slab_ctor ctor, enum pool_flags pf) {
+    if (obj_size < SLAB_MIN_OBJ) obj_size = SLAB_MIN_OBJ;
+    cache->name = name;
+    cache->obj_size = (obj_size + 7) & ~7;                     // 对象8字节对齐
+    cache->obj_offset = (sizeof(struct slab) + 7) & ~7;
+    cache->objs_per_slab = (PG_SIZE - cache->obj_offset) / cache->obj_size;
+    ASSERT(cache->objs_per_slab >= 1);
+    cache->pf = pf;
+    cache->ctor = ctor;
+    list_init(&cache->partial);
+    list_init(&cache->full);
+    list_init(&cache->empty);
+    cache->empty_cnt = 0;
+    lock_init(&cache->lock);
+}
+
+// 从内存池中申请一页作为新的slab，并对其中每个对象调用构造函数
+static struct slab* slab_grow(struct kmem_cache* cache) {
+    struct slab* slab = cache->pf == PF_KERNEL ? get_kernel_pages(1) : get_user_pages(1);
+    if (slab == NULL) return NULL;
+
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->free_map.bits = slab->map_bits;
+    slab->free_map.btmp_bytes_len = DIV_ROUND_UP(cache->objs_per_slab, 8);
+    bitmap_init(&slab->free_map);
+
+    if (cache->ctor != NULL) {
+        uint32_t idx;
+        for (idx = 0; idx < cache->objs_per_slab; idx++) {
+            cache->ctor(slab_obj(cache, slab, idx));
+        }
+    }
+    return slab;
+}
+
+// 将slab所在的页归还内存池
+static void slab_release(struct kmem_cache* cache, struct slab* slab) {
+    mfree_page_locked(cache->pf, slab, 1);
+}
+
+// 初始化slab分配器，kmem_cache结构体本身也由slab分配
+void slab_init(void) {
+    put_str("   slab_init start\n");
+    cache_setup(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), NULL, PF_KERNEL);
+    put_str("   slab_init done\n");
+}
+
+/**
+ * 创建对象大小为obj_size的cache.
+ * ctor在slab创建时对每个对象调用一次，释放回cache的对象应保持构造后的状态.
+ * pf指定slab页来自哪个内存池，供所有任务共享的对象必须使用PF_KERNEL.
+ */
+struct kmem_cache* kmem_cache_create(const char* name, uint32_t obj_size, slab_ctor ctor, enum pool_flags pf) {
+    if (obj_size > PG_SIZE - ((sizeof(struct slab) + 7) & ~7)) {
+        printk("kmem_cache_create: %s object too large\n", name);
+        return NULL;
+    }
+    struct kmem_cache* cache = kmem_cache_alloc(&cache_cache);
+    if (cache == NULL) return NULL;
+    cache_setup(cache, name, obj_size, ctor, pf);
+    return cache;
+}
+
+// 从cache中分配一个对象，失败返回NULL
+void* kmem_cache_alloc(struct kmem_cache* cache) {
+    struct slab* slab;
+    lock_acquire(&cache->lock);
+
+    // 优先使用部分分配的slab，其次是空slab，都没有再向内存池申请
+    if (!list_empty(&cache->partial)) {
+        slab = elem2entry(struct slab, slab_tag, cache->partial.head.next);
+    } else if (!list_empty(&cache->empty)) {
+        slab = elem2entry(struct slab, slab_tag, list_pop(&cache->empty));
+        cache->empty_cnt--;
+        list_push(&cache->partial, &slab->slab_tag);
+    } else {
+        slab = slab_grow(cache);
+        if (slab == NULL) {
+            lock_release(&cache->lock);
+            return NULL;
+        }
+        list_push(&cache->partial, &slab->slab_tag);
+    }
+
+    int idx = bitmap_scan(&slab->free_map, 1);
+    ASSERT(idx != -1 && (uint32_t)idx < cache->objs_per_slab);
+    bitmap_set(&slab->free_map, idx, 1);
+
+    if (++slab->inuse == cache->objs_per_slab) {
+        list_remove(&slab->slab_tag);
+        list_push(&cache->full, &slab->slab_tag);
+    }
+
+    lock_release(&cache->lock);
+    return slab_obj(cache, slab, idx);
+}
+
+// 将对象归还cache
+void kmem_cache_free(struct kmem_cache* cache, void* obj) {
+    if (obj == NULL) return;
+    struct slab* slab = obj2slab(obj);
+    ASSERT(slab->cache == cache);
+    uint32_t idx = ((uint32_t)obj - (uint32_t)slab - cache->obj_offset) / cache->obj_size;
+    ASSERT(idx < cache->objs_per_slab && bitmap_scan_test(&slab->free_map, idx));
+
+    lock_acquire(&cache->lock);
+    bitmap_set(&slab->free_map, idx, 0);
+
+    if (slab->inuse-- == cache->objs_per_slab) { // 原来是满的
+        list_remove(&slab->slab_tag);
+        list_push(&cache->partial, &slab->slab_tag);
+    }
+
+    if (slab->inuse == 0) {
+        list_remove(&slab->slab_tag);
+        if (cache->empty_cnt < SLAB_EMPTY_KEEP) {
+            list_push(&cache->empty, &slab->slab_tag);
+            cache->empty_cnt++;
+        } else {
+            slab_release(cache, slab);
+        }
+    }
+    lock_release(&cache->lock);
+}
+
+// 销毁cache，此时cache中不能还有已分配的对象
+void kmem_cache_destroy(struct kmem_cache* cache) {
+    ASSERT(cache != &cache_cache);
+    lock_acquire(&cache->lock);
+    if (!list_empty(&cache->partial) || !list_empty(&cache->full)) {
+        printk("kmem_cache_destroy: %s still has objects in use\n", cache->name);
+        lock_release(&cache->lock);
+        return;
+    }
+    while (!list_empty(&cache->empty)) {
+        slab_release(cache, elem2entry(struct slab, slab_tag, list_pop(&cache->empty)));
+    }
+    cache->empty_cnt = 0;
+    lock_release(&cache->lock);
+    kmem_cache_free(&cache_cache, cache);
+}
@@ -1,24 +1,96 @@
 #include <kernel/global.h>
 #include <kernel/string.h>
+#include <kernel/cpu.h>
 // #include <kernel/debug.h>
 #include <user/assert.h>
 
+/* string.o 也链接进用户程序，这里只能用内联汇编，不能引用内核的符号 */
 
-/* 将dst_起始的size个字节置为value */
+// 不少于这么多字节且都在内核空间时使用SSE2复制
+#define SSE2_COPY_MIN 512
+
+static bool sse2_ready = false;   // 只有内核调用 string_sse2_enable 后才为true，用户程序中的副本总是false
+static uint8_t fxsave_area[512] __attribute__ ((aligned (16)));
+
+/* 检测CPU是否支持SSE2，支持则打开CR4.OSFXSR并启用memcpy的SSE2路径.
+ * 只能在内核初始化时以0特权级调用 */
+void string_sse2_enable(void) {
+   uint32_t eax, ebx, ecx, edx;
+   cpuid(1, &eax, &ebx, &ecx, &edx);
+   if ((edx & (CPUID_EDX_SSE2 | CPUID_EDX_FXSR)) != (CPUID_EDX_SSE2 | CPUID_EDX_FXSR)) return;
+
+   write_cr0((read_cr0() & ~CR0_EM) | CR0_MP);
+   write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+   sse2_ready = true;
+}
+
+/* 以64字节为单位用xmm0~xmm3复制blocks块.
+ * 内核没有保存FPU状态的机制，用fxsave/fxrstor保留被中断者的xmm寄存器，
+ * 期间关中断防止切换到其他任务；只用于内核地址，复制时不会发生缺页 */
+static void memcpy_sse2(uint8_t* dst, const uint8_t* src, uint32_t blocks) {
+   uint32_t eflags;
+   asm volatile ("pushfl; popl %0; cli" : "=g" (eflags) : : "memory");
+   asm volatile ("fxsave %0" : "=m" (fxsave_area));
+   while (blocks-- > 0) {
+      asm volatile ("movdqu   (%0), %%xmm0\n\t"
+                    "movdqu 16(%0), %%xmm1\n\t"
+                    "movdqu 32(%0), %%xmm2\n\t"
+                    "movdqu 48(%0), %%xmm3\n\t"
+                    "movdqu %%xmm0,   (%1)\n\t"
+                    "movdqu %%xmm1, 16(%1)\n\t"
+                    "movdqu %%xmm2, 32(%1)\n\t"
+                    "movdqu %%xmm3, 48(%1)"
+                    : : "r" (src), "r" (dst) : "memory");
+      src += 64;
+      dst += 64;
+   }
+   asm volatile ("fxrstor %0" : : "m" (fxsave_area));
+   asm volatile ("pushl %0; popfl" : : "g" (eflags) : "memory", "cc");
+}
+
+// 当前是否运行在0特权级
+static inline bool in_ring0(void) {
+   uint16_t cs;
+   asm volatile ("movw %%cs, %0" : "=r" (cs));
+   return (cs & 3) == 0;
+}
+
+/* 将dst_起始的size个字节置为value，先按字节对齐dst，再用rep stosl每次写4字节 */
 void memset(void* dst_, uint8_t value, uint32_t size) {
    assert(dst_ != NULL);
    uint8_t* dst = (uint8_t*)dst_;
-   while (size-- > 0)
-      *dst++ = value;
+   uint32_t head = (-(uint32_t)dst) & 3;
+   if (head > size) head = size;
+   size -= head;
+   uint32_t dwords = size >> 2, tail = size & 3;
+   uint32_t pattern = (uint32_t)value * 0x01010101u;
+
+   asm volatile ("cld; rep stosb" : "+D" (dst), "+c" (head) : "a" (pattern) : "memory");
+   asm volatile ("rep stosl" : "+D" (dst), "+c" (dwords) : "a" (pattern) : "memory");
+   asm volatile ("rep stosb" : "+D" (dst), "+c" (tail) : "a" (pattern) : "memory");
 }
 
-/* 将src_起始的size个字节复制到dst_ */
+/* 将src_起始的size个字节复制到dst_，先按字节对齐dst，再用rep movsl每次复制4字节 */
 void memcpy(void* dst_, const void* src_, uint32_t size) {
    assert(dst_ != NULL && src_ != NULL);
    uint8_t* dst = dst_;
    const uint8_t* src = src_;
-   while (size-- > 0)
-      *dst++ = *src++;
+   uint32_t head = (-(uint32_t)dst) & 3;
+   if (head > size) head = size;
+   asm volatile ("cld; rep movsb" : "+D" (dst), "+S" (src), "+c" (head) : : "memory");
+   size -= (dst - (uint8_t*)dst_);
+
+   if (sse2_ready && size >= SSE2_COPY_MIN && (uint32_t)dst >= 0xc0000000 && \
+       (uint32_t)src >= 0xc0000000 && in_ring0()) {
+      memcpy_sse2(dst, src, size >> 6);
+      dst += size & ~63;
+      src += size & ~63;
+      size &= 63;
+   }
+
+   uint32_t dwords = size >> 2, tail = size & 3;
+   asm volatile ("rep movsl" : "+D" (dst), "+S" (src), "+c" (dwords) : : "memory");
+   asm volatile ("rep movsb" : "+D" (dst), "+S" (src), "+c" (tail) : : "memory");
 }
 
 /* 连续比较以地址a_和地址b_开头的size个字节,若相等则返回0,若a_大于b_返回+1,否则返回-1 */
@@ -26,6 +98,12 @@ int memcmp(const void* a_, const void* b_, uint32_t size) {
    const char* a = a_;
    const char* b = b_;
    assert(a != NULL || b != NULL);
+   // 相同的部分每次比较4字节，遇到不同的字再逐字节确定大小
+   while (size >= 4 && *(const uint32_t*)a == *(const uint32_t*)b) {
+      a += 4;
+      b += 4;
+      size -= 4;
+   }
    while (size-- > 0) {
       if(*a != *b) {
 	 return *a > *b ? 1 : -1; 
@@ -36,6 +114,9 @@ int memcmp(const void* a_, const void* b_, uint32_t size) {
    return 0;
 }
 
+// 字w的4个字节中是否有0
+#define HAS_ZERO_BYTE(w) (((w) - 0x01010101) & ~(w) & 0x80808080)
+
 /* 将字符串从src_复制到dst_ */
 char* strcpy(char* dst_, const char* src_) {
    assert(dst_ != NULL && src_ != NULL);
@@ -44,17 +125,35 @@ char* strcpy(char* dst_, const char* src_) {
    return r;
 }
 
-/* 返回字符串长度 */
+/* 返回字符串长度，对齐后每次检查4字节，对齐的字不会跨页，多读的字节不会缺页 */
 uint32_t strlen(const char* str) {
    assert(str != NULL);
    const char* p = str;
-   while(*p++);
-   return (p - str - 1);
+   while ((uint32_t)p & 3) {
+      if (*p == 0) return p - str;
+      p++;
+   }
+   while (!HAS_ZERO_BYTE(*(const uint32_t*)p)) p += 4;
+   while (*p) p++;
+   return p - str;
 }
 
 /* 比较两个字符串,若a_中的字符大于b_中的字符返回1,相等时返回0,否则返回-1. */
 int8_t strcmp (const char* a, const char* b) {
    assert(a != NULL && b != NULL);
+   // 两个串对齐方式相同时，对齐后每次比较4字节，直到字不同或含有结尾的0
+   if ((((uint32_t)a ^ (uint32_t)b) & 3) == 0) {
+      while (((uint32_t)a & 3) && *a != 0 && *a == *b) {
+         a++;
+         b++;
+      }
+      if (((uint32_t)a & 3) == 0) {
+         while (*(const uint32_t*)a == *(const uint32_t*)b && !HAS_ZERO_BYTE(*(const uint32_t*)a)) {
+            a += 4;
+            b += 4;
+         }
+      }
+   }
    while (*a != 0 && *a == *b) {
       a++;
       b++;
@@ -4,6 +4,7 @@
 #include <kernel/debug.h>
 #include <kernel/interrupt.h>
 #include <lib/kernel/print.h>
+#include <device/timer.h>
 
 void sema_init(struct semaphore* psema, uint8_t value) {
     psema->value = value;
@@ -37,6 +38,38 @@ void sema_down(struct semaphore* psema) {
     intr_set_status(old_status);
 }
 
+// 限时的信号量减少，最多等待m_seconds毫秒，成功返回true，超时返回false
+bool sema_down_timeout(struct semaphore* psema, uint32_t m_seconds) {
+    enum intr_status old_status = intr_disable();
+    struct task_struct* cur = running_thread();
+    uint32_t wakeup_tick = ticks + mtime_to_ticks(m_seconds);
+
+    while (psema->value == 0) {
+        if ((int32_t)(ticks - wakeup_tick) >= 0) { // 已经超时
+            intr_set_status(old_status);
+            return false;
+        }
+
+        ASSERT(!elem_find(&psema->waiters, &cur->general_tag));
+        list_append(&psema->waiters, &cur->general_tag);
+        cur->sleep_sema = psema;
+        cur->timed_out = false;
+        timer_add_sleeper(cur, wakeup_tick);
+        thread_block(TASK_BLOCKED);
+
+        // 超时由时钟中断唤醒时，已经被移出了等待队列和定时轮
+        if (cur->timed_out) {
+            intr_set_status(old_status);
+            return false;
+        }
+    }
+    psema->value--;
+    ASSERT(psema->value == 0);
+
+    intr_set_status(old_status);
+    return true;
+}
+
 //信号量增加
 void sema_up(struct semaphore* psema) {
     enum intr_status old_status = intr_disable();
@@ -45,6 +78,10 @@ void sema_up(struct semaphore* psema) {
     if (!list_empty(&psema->waiters)) {
         struct list_elem* node = list_pop(&psema->waiters);
         struct task_struct* thread_blocked = elem2entry(struct task_struct, general_tag, node);
+        if (thread_blocked->sleep_sema != NULL) { // 限时等待者被提前唤醒，撤销其定时
+            timer_del_sleeper(thread_blocked);
+            thread_blocked->sleep_sema = NULL;
+        }
         thread_unblock(thread_blocked);
     }
     
@@ -11,7 +11,9 @@
 #include <kernel/memory.h>
 #include <kernel/interrupt.h>
 #include <user/process.h>
+#include <user/vdso-init.h>
 #include <device/console.h>
+#include <device/timer.h>
 #include <fs/fs.h>
 #include <fs/file.h>
 
@@ -26,8 +28,19 @@ struct pid_pool {
 }pid_pool;
 
 struct task_struct* main_thread;      // 主线程的pcb
-struct list thread_ready_list;        // 就绪队列
+struct list thread_ready_list;        // 就绪队列，轮转调度时使用
 struct list thread_all_list;
+
+enum sched_policy sched_policy;       // 当前使用的调度策略，由编译时的 SCHED_POLICY 决定
+
+// 多级反馈队列：每级一个就绪队列，mlfq_ready_bitmap 的第 i 位表示第 i 级非空
+static struct list mlfq_ready_list[MLFQ_LEVELS];
+static uint32_t mlfq_ready_bitmap;
+// 每级的时间片，级别越低时间片越长
+static const uint8_t mlfq_slice[MLFQ_LEVELS] = {2, 4, 8, 16};
+// 每级的配额，在本级累计占用cpu超过配额就降一级，阻塞也不会重置，防止任务靠主动让出cpu赖在高优先级
+static const uint32_t mlfq_allot[MLFQ_LEVELS] = {4, 8, 16, 0};
+static uint32_t mlfq_last_boost;      // 上一次整体提升时的 ticks
 static struct list_elem* thread_tag;  // 记录tag,用于将结点转换到pcb
 
 struct task_struct* idle_thread;      // idle线程
@@ -41,6 +54,8 @@ extern void init();
 static void idle(void* arg UNUSED) {
     while (1) {
         thread_block(TASK_BLOCKED);
+        // 被唤醒说明没有其他任务可运行，先清零一个页框补充预先清零的页框池，没有可做的再挂起处理器
+        if (zero_pool_refill()) continue;
         // 开中断，hlt用于让处理器停止执行指令，将处理器挂起
         // 外部中断发生可唤醒处理器
         asm volatile ("sti; hlt" : : : "memory");
@@ -73,7 +88,7 @@ static void pid_pool_init() {
 
 static pid_t allocate_pid() {
     lock_acquire(&pid_pool.pid_lock);
-    int32_t bit_idx = bitmap_scan(&pid_pool.pid_bitmap, 1);
+    int32_t bit_idx = bitmap_scan_hint(&pid_pool.pid_bitmap); // pid轮转分配，刚释放的pid不会马上被复用
     bitmap_set(&pid_pool.pid_bitmap, bit_idx, 1);
     lock_release(&pid_pool.pid_lock);
     return (bit_idx + pid_pool.pid_start);
@@ -82,7 +97,7 @@ static pid_t allocate_pid() {
 void release_pid(pid_t pid) {
     lock_acquire(&pid_pool.pid_lock);
     int32_t bit_idx = pid - pid_pool.pid_start;
-    bitmap_set(&pid_pool, bit_idx, 0);
+    bitmap_set(&pid_pool.pid_bitmap, bit_idx, 0);
     lock_release(&pid_pool.pid_lock);
 }
 
@@ -91,6 +106,105 @@ pid_t fork_pid() {
     return allocate_pid();
 }
 
+// 返回线程在当前级别下的时间片
+uint8_t thread_slice(struct task_struct* pthread) {
+    if (sched_policy == SCHED_MLFQ) return mlfq_slice[pthread->mlfq_level];
+    return pthread->priority;
+}
+
+// 将线程加入就绪队列，at_head 为 true 时加到队首，须在关中断下调用
+static void ready_list_add(struct task_struct* pthread, bool at_head) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    struct list* plist = &thread_ready_list;
+    if (sched_policy == SCHED_MLFQ) {
+        plist = &mlfq_ready_list[pthread->mlfq_level];
+        mlfq_ready_bitmap |= (1 << pthread->mlfq_level);
+    }
+
+    if (elem_find(plist, &pthread->general_tag)) {
+        PANIC("ready_list_add: thread already in ready_list");
+    }
+    if (at_head) list_push(plist, &pthread->general_tag);
+    else list_append(plist, &pthread->general_tag);
+}
+
+// 将线程从就绪队列中摘下，须在关中断下调用
+static void ready_list_remove(struct task_struct* pthread) {
+    list_remove(&pthread->general_tag);
+    if (sched_policy == SCHED_MLFQ && list_empty(&mlfq_ready_list[pthread->mlfq_level])) {
+        mlfq_ready_bitmap &= ~(1 << pthread->mlfq_level);
+    }
+}
+
+static bool ready_list_empty(void) {
+    if (sched_policy == SCHED_MLFQ) return mlfq_ready_bitmap == 0;
+    return list_empty(&thread_ready_list);
+}
+
+// 取出下一个要运行的线程，多级反馈队列时通过位图 O(1) 找到最高的非空级
+static struct task_struct* ready_list_pop(void) {
+    struct list* plist = &thread_ready_list;
+    uint8_t level = 0;
+    if (sched_policy == SCHED_MLFQ) {
+        ASSERT(mlfq_ready_bitmap != 0);
+        level = __builtin_ctz(mlfq_ready_bitmap);
+        plist = &mlfq_ready_list[level];
+    }
+
+    ASSERT(!list_empty(plist));
+    thread_tag = list_pop(plist);
+    if (sched_policy == SCHED_MLFQ && list_empty(plist)) {
+        mlfq_ready_bitmap &= ~(1 << level);
+    }
+    //利用tag获取pcb的地址
+    return elem2entry(struct task_struct, general_tag, thread_tag);
+}
+
+// 供创建进程、fork 等使用，将新任务加入就绪队列队尾
+void ready_list_append(struct task_struct* pthread) {
+    enum intr_status old_status = intr_disable();
+    ready_list_add(pthread, false);
+    intr_set_status(old_status);
+}
+
+// 统计 cur 在当前级别已用的 cpu 嘀嗒，超过配额就降级
+static void mlfq_account(struct task_struct* cur) {
+    if (cur == idle_thread || cur->mlfq_level == MLFQ_LEVELS - 1) return;
+    if (cur->elapsed_ticks - cur->level_ticks >= mlfq_allot[cur->mlfq_level]) {
+        cur->mlfq_level++;
+        cur->level_ticks = cur->elapsed_ticks;
+    }
+}
+
+// list_traversal 的回调，将线程提升到 0 级
+static bool mlfq_boost_one(struct list_elem* pelem, int arg UNUSED) {
+    struct task_struct* pthread = elem2entry(struct task_struct, all_list_tag, pelem);
+    if (pthread == idle_thread) return false;
+    if (pthread->status == TASK_READY && pthread->mlfq_level != 0) {
+        ready_list_remove(pthread);
+        pthread->mlfq_level = 0;
+        ready_list_add(pthread, false);
+    }
+    pthread->mlfq_level = 0;
+    pthread->level_ticks = pthread->elapsed_ticks;
+    return false;
+}
+
+// 每隔 MLFQ_BOOST_TICKS 把所有任务提升到最高级，保证批处理任务不会饿死，
+// 也让由计算转为交互的任务能重新获得高优先级
+static void mlfq_boost(void) {
+    if (ticks - mlfq_last_boost < MLFQ_BOOST_TICKS) return;
+    mlfq_last_boost = ticks;
+    list_traversal(&thread_all_list, mlfq_boost_one, 0);
+}
+
+// 时钟中断中调用，判断是否有更高级别的任务就绪，需要抢占当前任务
+bool sched_need_preempt(struct task_struct* cur) {
+    if (sched_policy != SCHED_MLFQ || mlfq_ready_bitmap == 0) return false;
+    if (cur == idle_thread) return true;
+    return __builtin_ctz(mlfq_ready_bitmap) < cur->mlfq_level;
+}
+
 //初始化线程栈thread_stack（中断退出时从该栈中获取上下文环境）
 void thread_create(struct task_struct* pthread, thread_func function, void* func_arg) {
     pthread->self_kstack -= sizeof(struct intr_stack);//预留中断栈的空间
@@ -119,8 +233,11 @@ void init_thread(struct task_struct* pthread, char* name, int prio) {
 
     pthread->self_kstack = (uint32_t*)((uint32_t)pthread + PG_SIZE);
     pthread->priority = prio;
-    pthread->ticks = prio;
     pthread->elapsed_ticks = 0;
+    // 新任务从最高级开始，idle 线程始终在最低级
+    pthread->mlfq_level = 0;
+    pthread->level_ticks = 0;
+    pthread->ticks = thread_slice(pthread);
     pthread->pgdir = NULL;
 
     // 初始化文件描述符数组
@@ -160,10 +277,11 @@ struct task_struct* thread_start(char* name, int prio, thread_func function, voi
     // console_put_int((uint32_t)thread->pgdir);
     ASSERT(thread->pgdir == NULL);
     //将线程加入队列中
-    ASSERT(!elem_find(&thread_ready_list, &thread->general_tag));
-    list_append(&thread_ready_list, &thread->general_tag);
+    enum intr_status old_status = intr_disable();
+    ready_list_add(thread, false);
     ASSERT(!elem_find(&thread_all_list, &thread->all_list_tag));
     list_append(&thread_all_list, &thread->all_list_tag);
+    intr_set_status(old_status);
     
     return thread;
 }
@@ -183,25 +301,26 @@ void schedule(void) {
 
     struct task_struct* cur = running_thread();
 
+    if (sched_policy == SCHED_MLFQ) {
+        mlfq_account(cur);
+        mlfq_boost();
+    }
+
     if (cur->status == TASK_RUNNING) {//时间片用完加入就绪队列
-        ASSERT(!elem_find(&thread_ready_list, &cur->general_tag));
-        list_append(&thread_ready_list, &cur->general_tag);
-        cur->ticks = cur->priority;
+        cur->ticks = thread_slice(cur);
         cur->status = TASK_READY;
+        ready_list_add(cur, false);
     } else {
         //todo:线程被阻塞了
     }
 
-    if (list_empty(&thread_ready_list)) { // 如果就绪队列为空，就唤醒idle_thread
+    if (ready_list_empty()) { // 如果就绪队列为空，就唤醒idle_thread
         thread_unblock(idle_thread);
     }
 
     //将就绪队列的第一个线程弹出上处理器
-    ASSERT(!list_empty(&thread_ready_list));
     thread_tag = NULL;
-    thread_tag = list_pop(&thread_ready_list);
-    //利用tag获取pcb的地址
-    struct task_struct* next = elem2entry(struct task_struct, general_tag, thread_tag);
+    struct task_struct* next = ready_list_pop();
     next->status = TASK_RUNNING;
     // console_put_str("cur");
     // console_put_str(cur->name);
@@ -215,6 +334,7 @@ void schedule(void) {
     
     // 更新页表， 如果是用户进程就更新 tss.ss0
     process_activate(next);
+    vdso_switch(cur, next);
 
     switch_to(cur, next);
 
@@ -224,10 +344,9 @@ void schedule(void) {
 void thread_yield(void) {
     struct task_struct* cur = running_thread();
     enum intr_status old_status = intr_disable(); 
-    ASSERT(!elem_find(&thread_ready_list, &cur->general_tag));
 
-    list_append(&thread_ready_list, &cur->general_tag);
     cur->status = TASK_READY;
+    ready_list_add(cur, false);
 
     schedule();
 
@@ -260,12 +379,9 @@ void thread_unblock(struct task_struct* pthread) {
 
     if (pthread->status != TASK_READY) {
 
-        // ASSERT(!elem_find(&thread_ready_list, &pthread->general_tag));
-        if (elem_find(&thread_ready_list, &pthread->general_tag)) {
-            PANIC("blocked thread in ready_list");
-        }
-
-        list_push(&thread_ready_list, &pthread->general_tag); //加入就绪队列的队头
+        // 轮转调度时加入就绪队列的队头；多级反馈队列时排到本级队尾，
+        // 因阻塞而没用完配额的交互任务仍在高优先级，会很快被调度
+        ready_list_add(pthread, sched_policy == SCHED_RR);
         pthread->status = TASK_READY;
     }
 
@@ -345,14 +461,14 @@ void sys_ps() {
 // 回收线程的 PCB 和页表，并将它从调度队列中去除
 void thread_exit(struct task_struct* thread_over, bool need_schedule) {
     intr_disable();
-    thread_over->status = TASK_DIED;
 
     // 如果不是当前线程，那么就有可能在就绪队列中，将其从中删除
-    if (elem_find(&thread_ready_list, &thread_over->general_tag)) {
-        list_remove(&thread_over->general_tag);
+    if (thread_over->status == TASK_READY) {
+        ready_list_remove(thread_over);
     }
+    thread_over->status = TASK_DIED;
 
-    // 如果是内核进程就回收页表
+    // 如果是内核进程就回收页表，这里关着中断不能在内存池的锁上睡眠，pfree 自身在关中断下修改伙伴系统
     if (thread_over->pgdir) {
         mfree_page(PF_KERNEL, thread_over->pgdir, 1);
     }
@@ -391,7 +507,15 @@ struct task_struct* pid_to_thread(int32_t pid) {
 //初始化线程环境
 void thread_init(void) {
     put_str("thread_init start\n");
+    sched_policy = SCHED_POLICY;
     list_init(&thread_ready_list);
+    uint8_t level = 0;
+    while (level < MLFQ_LEVELS) {
+        list_init(&mlfq_ready_list[level]);
+        level++;
+    }
+    mlfq_ready_bitmap = 0;
+    mlfq_last_boost = 0;
     list_init(&thread_all_list);
 
     // lock_init(&pid_lock);
@@ -406,6 +530,12 @@ void thread_init(void) {
 
     // 创建idle线程
     idle_thread = thread_start("idle", 10, idle, NULL);
+    // idle 线程只在没有其他任务时运行，挪到最低级
+    enum intr_status old_status = intr_disable();
+    ready_list_remove(idle_thread);
+    idle_thread->mlfq_level = MLFQ_LEVELS - 1;
+    ready_list_add(idle_thread, false);
+    intr_set_status(old_status);
     put_str("thread_init done\n");
 }
 
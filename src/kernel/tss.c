@@ -3,6 +3,7 @@
 #include <kernel/global.h>
 #include <lib/kernel/print.h>
 #include <kernel/string.h>
+#include <kernel/cpu.h>
 
 struct TSS {
     uint32_t backlink;
@@ -36,6 +37,8 @@ struct TSS {
 
 static struct TSS tss;
 
+extern void sysenter_entry(void); // sysenter 快速系统调用的入口
+
 void update_tss_esp(struct task_struct* pthread) {
     tss.esp0 = (uint32_t*)((uint32_t)pthread + PG_SIZE);
 }
@@ -74,13 +77,28 @@ void tss_init() {
     *((struct gdt_desc*)0xc0000928) = make_gdt_desc((uint32_t*)0, 0xfffff, GDT_CODE_ATTR_LOW_DPL3, GDT_ATTR_HIGH);
     *((struct gdt_desc*)0xc0000930) = make_gdt_desc((uint32_t*)0, 0xfffff, GDT_DATA_ATTR_LOW_DPL3, GDT_ATTR_HIGH);
 
+    //向 gdt 中添加 sysenter/sysexit 使用的 0 级代码段、数据段和 3 级代码段、数据段
+    *((struct gdt_desc*)0xc0000938) = make_gdt_desc((uint32_t*)0, 0xfffff, GDT_CODE_ATTR_LOW_DPL0, GDT_ATTR_HIGH);
+    *((struct gdt_desc*)0xc0000940) = make_gdt_desc((uint32_t*)0, 0xfffff, GDT_DATA_ATTR_LOW_DPL0, GDT_ATTR_HIGH);
+    *((struct gdt_desc*)0xc0000948) = make_gdt_desc((uint32_t*)0, 0xfffff, GDT_CODE_ATTR_LOW_DPL3, GDT_ATTR_HIGH);
+    *((struct gdt_desc*)0xc0000950) = make_gdt_desc((uint32_t*)0, 0xfffff, GDT_DATA_ATTR_LOW_DPL3, GDT_ATTR_HIGH);
+
     //获取 gdt 的 16 位表界限&32 位表的起始地址
-    uint64_t gdt_operand = ((8 * 7 - 1) | (uint64_t)(uint32_t)0xc0000900 << 16);
+    uint64_t gdt_operand = ((8 * GDT_DESC_CNT - 1) | (uint64_t)(uint32_t)0xc0000900 << 16);
 
     //内联汇编加载 gdt 重新加载, 并将 tss 加载到 tr 寄存器
     asm volatile ("lgdt %0" : : "m" (gdt_operand));
     asm volatile ("ltr %w0" : : "r" (SELECTOR_TSS));
 
+    /* sysenter 进入内核时 esp 取自 MSR_SYSENTER_ESP，这里让它指向 tss.esp0，
+     * 入口处再从中取出当前任务的 0 级栈，这样切换任务时只需要像原来一样更新 tss.esp0 */
+    if (cpu_has_sysenter()) {
+        wrmsr(MSR_SYSENTER_CS, SELECTOR_SYSENTER_CS);
+        wrmsr(MSR_SYSENTER_ESP, (uint32_t)&tss.esp0);
+        wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
+        put_str("sysenter enabled.\n");
+    }
+
     put_str("tss_init and ltr done.\n");
     
 }
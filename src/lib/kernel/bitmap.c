@@ -7,6 +7,7 @@
 
 void bitmap_init(struct bitmap* btmap) {
     memset(btmap->bits, 0, btmap->btmp_bytes_len);
+    btmap->hint = 0;
 }
 
 /**
@@ -19,52 +20,104 @@ uint8_t bitmap_scan_test(struct bitmap* btmap, uint32_t index) {
     return (btmap->bits[byte_index] & BITMAP_MASK << bit_odd);
 }
 
+// 取位图的第w个32位字，超出位图长度的字节用fill中对应的字节填充
+static uint32_t bitmap_word(struct bitmap* btmp, uint32_t w, uint32_t fill) {
+    uint32_t byte_idx = w * 4;
+    if (byte_idx + 4 <= btmp->btmp_bytes_len) {
+        return *(uint32_t*)(btmp->bits + byte_idx);
+    }
+    uint32_t val = fill, i = 0;
+    while (byte_idx + i < btmp->btmp_bytes_len) {
+        val &= ~(0xffu << (i * 8));
+        val |= (uint32_t)btmp->bits[byte_idx + i] << (i * 8);
+        i++;
+    }
+    return val;
+}
+
+/**
+ * 从from位开始向后找第一个为0的位，没有返回-1.
+ * 按32位字扫描，字内用bsf（__builtin_ctz）定位.
+ */
+int bitmap_next_clear(struct bitmap* btmp, uint32_t from) {
+    uint32_t bits_len = btmp->btmp_bytes_len * 8;
+    if (from >= bits_len) return -1;
+
+    uint32_t w = from / 32, words = DIV_ROUND_UP(bits_len, 32);
+    // 取反后找为1的位，超出长度的位视为已占用
+    uint32_t val = ~bitmap_word(btmp, w, 0xffffffff) & (0xffffffff << (from % 32));
+    while (val == 0) {
+        if (++w == words) return -1;
+        val = ~bitmap_word(btmp, w, 0xffffffff);
+    }
+    return w * 32 + __builtin_ctz(val);
+}
+
+/**
+ * 从from位开始向后找第一个为1的位，没有返回-1.
+ */
+int bitmap_next_set(struct bitmap* btmp, uint32_t from) {
+    uint32_t bits_len = btmp->btmp_bytes_len * 8;
+    if (from >= bits_len) return -1;
+
+    uint32_t w = from / 32, words = DIV_ROUND_UP(bits_len, 32);
+    uint32_t val = bitmap_word(btmp, w, 0) & (0xffffffff << (from % 32));
+    while (val == 0) {
+        if (++w == words) return -1;
+        val = bitmap_word(btmp, w, 0);
+    }
+    return w * 32 + __builtin_ctz(val);
+}
+
 /**
  * 在位图中申请连续的cnt个位.
+ * 交替找下一个空闲位和下一个占用位，每段空闲区只看一次，不再逐位测试.
  */
 int bitmap_scan(struct bitmap* btmp, uint32_t cnt) {
-    uint32_t idx_byte = 0;
-    /* 先逐字节比较，蛮力法 */ 
-    while (( 0xff == btmp->bits[idx_byte]) && (idx_byte < btmp->btmp_bytes_len)) { 
-        idx_byte++; //1 表示该位已分配，若为 0xff，则表示该字节内已无空闲位，向下一字节继续找 */ 
-    } 
-
-    ASSERT(idx_byte < btmp->btmp_bytes_len); 
-    if (idx_byte == btmp->btmp_bytes_len) { // 若该内存池找不到可用空间
-        return -1; 
-    } 
-/* 若在位图数组范围内的某字节内找到了空闲,在该字节内逐位比对，返回空闲位的索引。*/ 
-    int idx_bit = 0; 
-    /* 和 btmp->bits[idx_byte]这个字节逐位对比 */ 
-    while ((uint8_t)(BITMAP_MASK << idx_bit) & btmp->bits[idx_byte]) { 
-        idx_bit++; 
-    } 
-    
-    int bit_idx_start = idx_byte * 8 + idx_bit; // 空闲位在位图内的下标
-    if (cnt == 1) { 
-        return bit_idx_start; 
-    } 
-    
-    uint32_t bit_left = (btmp->btmp_bytes_len * 8 - bit_idx_start); // 记录还有多少位可以判断
-    uint32_t next_bit = bit_idx_start + 1; 
-    uint32_t count = 1; // 用于记录找到的空闲位的个数
-
-    bit_idx_start = -1; // 先将其置为−1，若找不到连续的位就直接返回
-    while (bit_left-- > 0) { 
-    if (!(bitmap_scan_test(btmp, next_bit))) { // 若 next_bit 为 0 
-        count ++; 
-    } else { 
-        count = 0; 
-    } 
-    if (count == cnt) { // 若找到连续的 cnt 个空位
-        bit_idx_start = next_bit - cnt + 1; 
-        break; 
-    } 
-    next_bit ++; 
-    } 
-    return bit_idx_start;
+    uint32_t bits_len = btmp->btmp_bytes_len * 8;
+    int start = bitmap_next_clear(btmp, 0);
+
+    while (start != -1) {
+        int end = bitmap_next_set(btmp, start);
+        if (end == -1) end = bits_len;
+        if ((uint32_t)(end - start) >= cnt) return start;
+        start = bitmap_next_clear(btmp, end);
+    }
+    return -1;
 }
 
+/**
+ * 从提示位置开始找一个空闲位，到末尾后回绕，找到后提示移到它的下一位.
+ * 分配结果轮转，不必每次从开头跨过已经占用的位.
+ */
+int bitmap_scan_hint(struct bitmap* btmp) {
+    int idx = bitmap_next_clear(btmp, btmp->hint);
+    if (idx == -1 && btmp->hint != 0) idx = bitmap_next_clear(btmp, 0);
+    if (idx != -1) btmp->hint = idx + 1;
+    return idx;
+}
+
+/**
+ * 找出位图中最长的连续空闲区，返回起始位，*run_len 返回长度，没有空闲位返回-1.
+ */
+int bitmap_longest_run(struct bitmap* btmp, uint32_t* run_len) {
+    uint32_t bits_len = btmp->btmp_bytes_len * 8;
+    int best = -1;
+    uint32_t best_len = 0;
+    int start = bitmap_next_clear(btmp, 0);
+
+    while (start != -1) {
+        int end = bitmap_next_set(btmp, start);
+        if (end == -1) end = bits_len;
+        if ((uint32_t)(end - start) > best_len) {
+            best = start;
+            best_len = end - start;
+        }
+        start = bitmap_next_clear(btmp, end);
+    }
+    *run_len = best_len;
+    return best;
+}
 
 void bitmap_set(struct bitmap* btmap, uint32_t index, int8_t value) {
     ASSERT(value == 0 || value == 1);
@@ -18,11 +18,15 @@
 #include <fs/dir.h>
 #include <fs/file.h>
 #include <fs/inode.h>
+#include <kernel/bench.h>
 
 void init();
 int main(void) {
    put_str("I am kernel\n");
    init_all();
+#ifdef KBENCH
+   bench_run();
+#endif
    // intr_enable();
    // process_execute(u_prog_a, "u_prog_a");
    // process_execute(u_prog_b, "u_prog_b");
@@ -236,4 +236,12 @@ int32_t buildin_rm(uint32_t argc, char** argv) {
 
 void buildin_help(uint32_t argc, char** argv) {
     help();
+}
+
+void buildin_iostat(uint32_t argc, char** argv UNUSED) {
+    if (argc != 1) {
+        printf("iostat: no argument support\n");
+        return;
+    }
+    iostat();
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 #include <user/syscall.h>
 #include <kernel/string.h>
 
+#define SPLICE_SIZE (16 * 1024)  // 每次 splice 搬运的字节数
+
 int main(int argc, char** argv) {
 
     if (argc > 2) {
@@ -9,7 +11,13 @@ int main(int argc, char** argv) {
         exit(-2);
     }
 
-    if (argc == 1) { // 修改为从键盘获取数据
+    if (argc == 1) { // 从标准输入读取数据
+        // 标准输入是管道时用 splice 在内核中直接搬到标准输出，一直读到写端全部关闭
+        int32_t ret = 0;
+        while ((ret = splice(0, 1, SPLICE_SIZE)) > 0);
+        if (ret == 0) exit(0);
+
+        // splice 不支持键盘输入，键盘不会返回 EOF，只读取一次
         char buf[512] = {0};
         read(0, buf, 512);
         printf("%s", buf);
@@ -40,14 +48,20 @@ int main(int argc, char** argv) {
         return -1;
     }
 
+    // 用 splice 把文件数据直接从块缓存搬到标准输出，不支持时退回 read/write
+    int32_t ret = 0;
+    while ((ret = splice(fd, 1, SPLICE_SIZE)) > 0);
+
     int read_bytes = 0;
-    while(1) {
+    while(ret == -1) {
        
         read_bytes = read(fd, buf, buf_size);
         if (read_bytes == -1) {
             break;
         }
-        write(1, buf, read_bytes);
+        if ((int32_t)write(1, buf, read_bytes) == -1) { // 标准输出是管道且读端已全部关闭
+            break;
+        }
     }
 
     free(buf);
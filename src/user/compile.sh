@@ -17,7 +17,7 @@ CFLAGS="-Wall -fno-pie -c -fno-stack-protector -nostdinc -fno-builtin -W \
        -fomit-frame-pointer -Wstrict-prototypes -Wmissing-prototypes -Wsystem-headers -m32"
 LIB="../include/"
 OBJS="../build/string.o ../build/syscall.o \
-      ../build/stdio.o  ../build/assert.o ./start.o"
+      ../build/stdio.o  ../build/assert.o ../build/vdso.o ./start.o"
 DD_IN=$BIN
 DD_OUT="../../hd60.img" 
 
@@ -1,4 +1,6 @@
 #include <fs/fs.h>
+#include <fs/file.h>
+#include <fs/inode.h>
 #include <lib/stdio.h>
 #include <user/exec.h>
 #include <user/assert.h>
@@ -56,15 +58,16 @@ enum segment_type {
 };
 
 
-// 将文件描述符 fd 指向的文件中，便宜为 offset，大小为 filesz 的段加载到虚拟地址为 vaddr 的位置
-static bool segment_load (int32_t fd, uint32_t offset, uint32_t filesz, uint32_t vaddr) {
+#if !EXEC_DEMAND_PAGING
+// 将文件描述符 fd 指向的文件中，便宜为 offset，大小为 filesz 的段加载到虚拟地址为 vaddr 的位置，memsz 中超出 filesz 的 bss 清零
+static bool segment_load (int32_t fd, uint32_t offset, uint32_t filesz, uint32_t memsz, uint32_t vaddr) {
     
     uint32_t vaddr_first_page = vaddr & 0xfffff000;
     uint32_t size_in_first_page = PG_SIZE - (vaddr & 0x00000fff);
 
     uint32_t occupied_pages = 0; //该段占有的页框数
-    if (filesz > size_in_first_page) {
-        uint32_t left_size = filesz - size_in_first_page;
+    if (memsz > size_in_first_page) {
+        uint32_t left_size = memsz - size_in_first_page;
         occupied_pages = DIV_ROUND_UP(left_size, PG_SIZE) + 1;
     } else occupied_pages = 1;
 
@@ -95,6 +98,117 @@ static bool segment_load (int32_t fd, uint32_t offset, uint32_t filesz, uint32_t
     sys_lseek(fd, offset, SEEK_SET);
     // printf("vaddr%d filesz %d fd%d\n", vaddr, filesz, fd);
     sys_read(fd, (void*)vaddr, filesz);
+    memset((void*)(vaddr + filesz), 0, memsz - filesz);
+    return true;
+}
+
+#endif
+
+// 对当前进程 [start, start + size) 所在的每一页调用 fn
+static void vma_for_each_page(uint32_t start, uint32_t size, void (*fn)(uint32_t page_vaddr)) {
+    uint32_t page_vaddr = start & 0xfffff000;
+    while (page_vaddr < start + size) {
+        fn(page_vaddr);
+        page_vaddr += PG_SIZE;
+    }
+}
+
+// 释放页框和页的虚拟地址
+static void vma_unmap_page(uint32_t page_vaddr) {
+    struct task_struct* cur = running_thread();
+    user_page_unmap(page_vaddr);
+    bitmap_set(&cur->userprog_vaddr.vaddr_bitmap, (page_vaddr - cur->userprog_vaddr.vaddr_start) / PG_SIZE, 0);
+}
+
+#if EXEC_DEMAND_PAGING
+// 占用页的虚拟地址但不分配页框，之前映射的页（旧的进程体）一并释放
+static void vma_reserve_page(uint32_t page_vaddr) {
+    struct task_struct* cur = running_thread();
+    user_page_unmap(page_vaddr);
+    bitmap_set(&cur->userprog_vaddr.vaddr_bitmap, (page_vaddr - cur->userprog_vaddr.vaddr_start) / PG_SIZE, 1);
+}
+
+// 按需调页：只记录 fd 对应文件中的可加载段，页在第一次访问时由 vma_page_fault 调入
+static bool segment_map(int32_t fd, struct Elf32_Phdr* prog_header) {
+    struct task_struct* cur = running_thread();
+    uint32_t vma_idx = 0;
+    while (vma_idx < MAX_VMAS && cur->vmas[vma_idx].inode != NULL) vma_idx++;
+    if (vma_idx == MAX_VMAS) return false;
+
+    struct vm_area* vma = &cur->vmas[vma_idx];
+    vma->start = prog_header->p_vaddr;
+    vma->mem_sz = prog_header->p_memsz;
+    vma->file_sz = prog_header->p_filesz;
+    vma->file_off = prog_header->p_offset;
+    // 文件描述符在 execv 结束时关闭，区域自己持有一次i结点的打开
+    vma->inode = inode_open(cur_part, file_table[fd_local_to_global(fd)].fd_inode->i_no);
+
+    vma_for_each_page(vma->start, vma->mem_sz, vma_reserve_page);
+    return true;
+}
+#endif
+
+// 关闭进程各区域持有的i结点，进程退出时调用，页框由回收页表时释放
+void vma_release(struct task_struct* pthread) {
+    uint32_t vma_idx = 0;
+    while (vma_idx < MAX_VMAS) {
+        if (pthread->vmas[vma_idx].inode != NULL) {
+            inode_close(pthread->vmas[vma_idx].inode);
+            pthread->vmas[vma_idx].inode = NULL;
+        }
+        vma_idx++;
+    }
+}
+
+// fork 出的子进程继承父进程的区域，增加i结点的打开次数
+void vma_fork(struct task_struct* child) {
+    uint32_t vma_idx = 0;
+    while (vma_idx < MAX_VMAS) {
+        if (child->vmas[vma_idx].inode != NULL) child->vmas[vma_idx].inode->i_open_cnt++;
+        vma_idx++;
+    }
+}
+
+// 用区域vma在文件中的数据填充已映射并清零的页 page_vaddr，页中不属于文件数据的部分保持为0
+static void vma_fill_page(struct vm_area* vma, uint32_t page_vaddr) {
+    uint32_t data_start = vma->start > page_vaddr ? vma->start : page_vaddr;
+    uint32_t data_end = vma->start + vma->file_sz;
+    if (data_end > page_vaddr + PG_SIZE) data_end = page_vaddr + PG_SIZE;
+    if (data_start >= data_end) return;
+
+    // 借一个临时的文件结构直接读i结点，不占用文件表
+    struct file seg_file;
+    memset(&seg_file, 0, sizeof(struct file));
+    seg_file.fd_inode = vma->inode;
+    seg_file.fd_pos = vma->file_off + (data_start - vma->start);
+    file_read(&seg_file, (void*)data_start, data_end - data_start);
+}
+
+/* 缺页异常中为当前进程调入区域中的页，处理了返回true。
+ * 相邻的段可能共用一页，所以用所有覆盖该页的区域填充 */
+bool vma_page_fault(uint32_t vaddr) {
+    struct task_struct* cur = running_thread();
+    if (cur->pgdir == NULL || vaddr >= 0xc0000000) return false;
+
+    uint32_t page_vaddr = vaddr & 0xfffff000;
+    uint32_t vma_idx = 0;
+    struct vm_area* vma;
+    while (vma_idx < MAX_VMAS) {
+        vma = &cur->vmas[vma_idx];
+        if (vma->inode != NULL && vaddr >= (vma->start & 0xfffff000) && vaddr < vma->start + vma->mem_sz) break;
+        vma_idx++;
+    }
+    if (vma_idx == MAX_VMAS) return false;
+
+    // 页已经存在说明是权限错误，不归这里处理
+    uint32_t* pde = pde_ptr(page_vaddr);
+    if ((*pde & PG_P_1) && (*pte_ptr(page_vaddr) & PG_P_1)) return false;
+
+    if (get_a_page_without_opvaddrbitmap(PF_USER | PF_ZERO, page_vaddr) == NULL) return false;
+
+    for (vma_idx = 0; vma_idx < MAX_VMAS; vma_idx++) {
+        if (cur->vmas[vma_idx].inode != NULL) vma_fill_page(&cur->vmas[vma_idx], page_vaddr);
+    }
     return true;
 }
 
@@ -130,6 +244,17 @@ static int32_t load(const char* pathname) {
     Elf32_Off  ph_offset = elf_header.e_phoff;     // 程序头部表的偏移
     Elf32_Half ph_size   = elf_header.e_phentsize; // 程序头部表的总大小
 
+    // 旧进程体的区域作废，释放已调入的页
+    struct task_struct* cur = running_thread();
+    uint32_t vma_idx = 0;
+    while (vma_idx < MAX_VMAS) {
+        if (cur->vmas[vma_idx].inode != NULL) {
+            vma_for_each_page(cur->vmas[vma_idx].start, cur->vmas[vma_idx].mem_sz, vma_unmap_page);
+        }
+        vma_idx++;
+    }
+    vma_release(cur);
+
     // 遍历程序头部表（结构体数组），遇到可加载的段就读入内存
     uint32_t seg_idx = 0;
     while (seg_idx < elf_header.e_phnum) {
@@ -144,7 +269,12 @@ static int32_t load(const char* pathname) {
         // 如果是可加载的，就加载到内存中
         if (prog_header.p_type == PT_LOAD) {
             // printf("prog_header.p_vaddr: %d\n", prog_header.p_vaddr);
-            if (!segment_load(fd, prog_header.p_offset, prog_header.p_filesz, prog_header.p_vaddr)) {
+#if EXEC_DEMAND_PAGING
+            if (!segment_map(fd, &prog_header)) {
+#else
+            if (!segment_load(fd, prog_header.p_offset, prog_header.p_filesz, \
+                              prog_header.p_memsz, prog_header.p_vaddr)) {
+#endif
                 ret = -1;
                 goto done;
             }
@@ -8,6 +8,7 @@
 #include <fs/file.h>
 #include <user/pipe.h>
 #include <user/process.h>
+#include <user/exec.h>
 #include <lib/kernel/stdint.h>
 #include <device/console.h>
 
@@ -21,7 +22,9 @@ static int32_t copy_pcb_vaddrbitmap_stack(struct task_struct* child_thread, \
     child_thread->pid = fork_pid();
     child_thread->status = TASK_READY; // 将新进程加入就绪队列中，之后调度其上CPU
     child_thread->elapsed_ticks = 0;
-    child_thread->ticks = child_thread->priority;
+    child_thread->mlfq_level = 0;   // 新进程从多级反馈队列的最高级开始
+    child_thread->level_ticks = 0;
+    child_thread->ticks = thread_slice(child_thread);
     child_thread->parent_pid = parent_thread->pid;
 
     child_thread->general_tag.prev = child_thread->general_tag.next = NULL;
@@ -49,47 +52,23 @@ static int32_t copy_pcb_vaddrbitmap_stack(struct task_struct* child_thread, \
 }
 
 
-// 将父进程的程序体（代码段数据段等）用户栈复制给子进程。其中页缓冲区buf_page必须是内核页
-static void copy_block_stack3(struct task_struct* child_thread,  \
-                              struct task_struct* parent_thread, void* buf_page) {
-    uint8_t* vaddr_bitmap = parent_thread->userprog_vaddr.vaddr_bitmap.bits;
-    uint32_t btmp_bytes_len = parent_thread->userprog_vaddr.vaddr_bitmap.btmp_bytes_len;
+/* 让子进程与父进程写时复制地共享程序体（代码段数据段等）和用户栈，不复制页的内容。
+ * 页表项直接写进子进程的页表，不用切换cr3 */
+static void share_block_stack3(struct task_struct* child_thread,  \
+                               struct task_struct* parent_thread) {
+    struct bitmap* vaddr_bitmap = &parent_thread->userprog_vaddr.vaddr_bitmap;
     uint32_t vaddr_start =parent_thread->userprog_vaddr.vaddr_start;
-
-    uint32_t idx_byte = 0;
-    uint32_t idx_bit = 0;
     uint32_t prog_vaddr = 0;
-
-    // 将父进程用户空间中的数据复制到内核的页缓冲区，再复制到子进程中
-    while (idx_byte < btmp_bytes_len) { // 逐字节查看位图
-        if (vaddr_bitmap[idx_byte]) {   
-            idx_bit = 0;
-            while (idx_bit < 8) {       // 逐位查看该字节
-                if ((BITMAP_MASK << idx_bit) & vaddr_bitmap[idx_byte]) {
-
-                    prog_vaddr = vaddr_start + (idx_byte * 8 + idx_bit) * PG_SIZE;
-
-                    // 利用内核页中转，将父进程用户空间的数据复制到子进程的用户空间
-                    memcpy(buf_page, (const void*)prog_vaddr, PG_SIZE);
-
-                    // 激活子进程的页表，确保pte和pde安装在子进程的页目录表中
-                    page_dir_activate(child_thread);
-
-                    // 为子进程的虚拟地址分配一个物理页
-                    get_a_page_without_opvaddrbitmap(PF_USER, prog_vaddr);
-
-                    // 内核空间到子进程的用户空间
-                    memcpy((void*)prog_vaddr, buf_page, PG_SIZE);
-
-                    // 恢复父进程的页表
-                    page_dir_activate(parent_thread);
-                }
-                idx_bit++;
-            }
-        }
-        idx_byte++;
+    uint32_t pte = 0;
+
+    // 只访问位图中已分配的虚拟页
+    int32_t bit_idx = bitmap_next_set(vaddr_bitmap, 0);
+    while (bit_idx != -1) {
+        prog_vaddr = vaddr_start + bit_idx * PG_SIZE;
+        pte = cow_share_page(prog_vaddr);
+        if (pte != 0) page_table_set_in(child_thread->pgdir, prog_vaddr, pte);
+        bit_idx = bitmap_next_set(vaddr_bitmap, bit_idx + 1);
     }
-
 }
 
 // 修改函数返回值为0，为子进程构建线程栈thread_stack
@@ -120,17 +99,17 @@ static int32_t build_child_statck(struct task_struct* child_thread) {
     return 0;
 }
 
-// 更新线程的i结点打开次数，除前3个标准文件描述符
+// 更新线程的i结点打开次数，前3个标准文件描述符只有被重定向为管道时才需要更新
 static void update_inode_open_cnts(struct task_struct* thread) {
-    int32_t local_fd = 3, global_fd = 0;
+    int32_t local_fd = 0, global_fd = 0;
     while (local_fd < MAX_FILES_OPEN_PER_PROC) {
         global_fd = thread->fdtable[local_fd];
         ASSERT(global_fd < MAX_FILES_OPEN);
         if (global_fd != -1) {
             if (is_pipe(local_fd)) {
-                // 如果是管道 fd_pos 被复用为管道的打开次数
-                file_table[global_fd].fd_pos++;
-            } else {
+                // 子进程复制了管道端的文件描述符，增加该端的引用
+                pipe_get(global_fd);
+            } else if (local_fd > 2) {
                 file_table[global_fd].fd_inode->i_open_cnt++;
             }
         }
@@ -143,9 +122,6 @@ static void update_inode_open_cnts(struct task_struct* thread) {
 static int32_t copy_process(struct task_struct* child_thread, \
                             struct task_struct* parent_thread) {
 
-    void* buf_page = get_kernel_pages(1); // 申请了一页大小的内核空间作为内核缓冲区
-    if (buf_page == NULL) return -1;                       
-
     // 父进程的PCB 虚拟地址位图 内核栈
     if (copy_pcb_vaddrbitmap_stack(child_thread, parent_thread) == -1) return -1;
 
@@ -153,16 +129,15 @@ static int32_t copy_process(struct task_struct* child_thread, \
     child_thread->pgdir = create_page_dir();
     if (child_thread->pgdir == NULL) return -1;
 
-    // 父进程的程序体和用户栈
-    copy_block_stack3(child_thread, parent_thread, buf_page);
+    // 父进程的程序体和用户栈，写时复制
+    share_block_stack3(child_thread, parent_thread);
 
     // 子进程的thread_stack 修改返回值
     build_child_statck(child_thread);
 
-    // 相关文件i结点的打开次数
+    // 相关文件i结点的打开次数，包括按需调页的区域持有的
     update_inode_open_cnts(child_thread);
-
-    mfree_page(PF_KERNEL, buf_page, 1);
+    vma_fork(child_thread);
 
     return 0;
 }
@@ -201,8 +176,7 @@ pid_t sys_fork() {
     // // ASSERT(1 == 2);
 
     // 加入就绪队列和所有线程队列
-    ASSERT(!elem_find(&thread_ready_list, &child_thread->general_tag));
-    list_append(&thread_ready_list, &child_thread->general_tag);
+    ready_list_append(child_thread);
     ASSERT(!elem_find(&thread_all_list, &child_thread->all_list_tag));
     list_append(&thread_all_list, &child_thread->all_list_tag);
 
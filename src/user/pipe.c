@@ -2,85 +2,273 @@
 #include <fs/file.h>
 #include <user/pipe.h>
 #include <device/ioqueue.h>
+#include <device/console.h>
+#include <kernel/slab.h>
+#include <kernel/memory.h>
+#include <kernel/debug.h>
+#include <kernel/interrupt.h>
 #include <kernel/global.h>
 #include <lib/kernel/stdint.h>
 #include <lib/kernel/stdio-kernel.h>
 
+static struct kmem_cache* pipe_cache;  // 管道的cache
+
+// 创建管道的cache，环形缓冲区在slab创建时初始化，释放时保持为空队列
+void pipe_init(void) {
+    pipe_cache = kmem_cache_create("pipe", sizeof(struct pipe), (slab_ctor)ioqueue_init, PF_KERNEL);
+    if (pipe_cache == NULL) PANIC("pipe_init: create cache failed");
+}
+
+static bool global_fd_is_pipe(int32_t global_fd) {
+    return global_fd > 2 && file_table[global_fd].fd_flag == PIPE_FLAG;
+}
+
+// 释放管道，另外分配的大缓冲区归还后恢复为自带的缓冲区
+static void pipe_free(struct pipe* p) {
+    if (p->ioq.buf != p->ioq.data) {
+        mfree_page_locked(PF_KERNEL, p->ioq.buf, p->ioq.size / PG_SIZE);
+    }
+    p->ioq.head = p->ioq.tail = 0;
+    ioqueue_set_buf(&p->ioq, p->ioq.data, bufsize);
+    kmem_cache_free(pipe_cache, p);
+}
+
+// 管道端多了一个文件描述符引用，fork 和重定向时调用
+void pipe_get(uint32_t global_fd) {
+    struct pipe* p = (struct pipe*)file_table[global_fd].fd_inode;
+    if (file_table[global_fd].fd_pos == PIPE_READ) p->readers++;
+    else p->writers++;
+}
+
+/* 管道端少了一个文件描述符引用
+ * 某一端的引用归零时释放它的全局文件表项，并唤醒在另一端睡眠的线程，使其看到 EOF 或写失败
+ * 两端都归零时释放管道，丢弃未读的数据使缓冲区恢复为构造后的空队列 */
+void pipe_put(uint32_t global_fd) {
+    struct file* f = &file_table[global_fd];
+    struct pipe* p = (struct pipe*)f->fd_inode;
+    enum intr_status old_status = intr_disable();
+
+    if (f->fd_pos == PIPE_READ) {
+        if (--p->readers == 0) {
+            f->fd_inode = NULL;
+            if (p->ioq.producer != NULL) ioq_wakeup(&p->ioq.producer);
+        }
+    } else {
+        if (--p->writers == 0) {
+            f->fd_inode = NULL;
+            if (p->ioq.consumer != NULL) ioq_wakeup(&p->ioq.consumer);
+        }
+    }
+
+    if (p->readers == 0 && p->writers == 0) pipe_free(p);
+    intr_set_status(old_status);
+}
+
 bool is_pipe(uint32_t local_fd) {
     uint32_t global_fd = fd_local_to_global(local_fd);
     return file_table[global_fd].fd_flag == PIPE_FLAG;
 }
 
-// 创建管道
-int32_t sys_pipe(int32_t pipefd[2]) {
-    int32_t global_fd = get_free_slot_in_global(); 
-    file_table[global_fd].fd_inode = get_kernel_pages(1); // 申请一页内核空间作为环形缓冲区
+// 在全局文件表中占一个表项作为管道的一端
+static int32_t pipe_end_install(struct pipe* p, enum pipe_end end) {
+    int32_t global_fd = get_free_slot_in_global();
+    if (global_fd == -1) return -1;
+    file_table[global_fd].fd_inode = (struct inode*)p;  // 管道的内存缓冲区
+    file_table[global_fd].fd_flag = PIPE_FLAG;          // 将 fd_flag 位复用为管道标识
+    file_table[global_fd].fd_pos = end;                 // 将 fd_pos  位复用为管道的哪一端
+    return global_fd;
+}
 
-    ioqueue_init((struct ioqueue*)file_table[global_fd].fd_inode);
+/* 创建缓冲区大小为 size 字节的管道，pipefd[0] 为读端，pipefd[1] 为写端
+ * size 不超过 bufsize 时使用管道自带的缓冲区，否则按页分配，最大 PIPE_MAX_SIZE */
+int32_t sys_pipe_sized(int32_t pipefd[2], uint32_t size) {
+    struct pipe* p = kmem_cache_alloc(pipe_cache);
+    if (p == NULL) return -1;
+    p->readers = p->writers = 0;
 
-    if (file_table[global_fd].fd_inode == NULL) return -1;
+    if (size > bufsize) {
+        uint32_t pg_cnt = DIV_ROUND_UP((size > PIPE_MAX_SIZE ? PIPE_MAX_SIZE : size), PG_SIZE);
+        char* buf = get_kernel_pages(pg_cnt);
+        if (buf == NULL) {
+            pipe_free(p);
+            return -1;
+        }
+        ioqueue_set_buf(&p->ioq, buf, pg_cnt * PG_SIZE);
+    }
 
-    file_table[global_fd].fd_flag = PIPE_FLAG; // 将 fd_flag 位复用为管道标识
-    file_table[global_fd].fd_pos = 2;          // 将 fd_pos  位复用为管道的打开数
+    int32_t read_global_fd = pipe_end_install(p, PIPE_READ);
+    if (read_global_fd == -1) {
+        pipe_free(p);
+        return -1;
+    }
+    p->readers = 1;
+    int32_t write_global_fd = pipe_end_install(p, PIPE_WRITE);
+    if (write_global_fd == -1) {
+        pipe_put(read_global_fd);
+        return -1;
+    }
+    p->writers = 1;
 
-    pipefd[0] = pcb_fd_install(global_fd);  // 将文件描述符修改为管道文件结构在 file_table 中的下标
-    pipefd[1] = pcb_fd_install(global_fd);
-    // printk("pipefd %d %d global_fd %d\n", pipefd[0], pipefd[1], global_fd);
+    pipefd[0] = pcb_fd_install(read_global_fd);  // 将文件描述符修改为管道文件结构在 file_table 中的下标
+    pipefd[1] = pcb_fd_install(write_global_fd);
+    if (pipefd[0] == -1 || pipefd[1] == -1) {
+        if (pipefd[0] != -1) running_thread()->fdtable[pipefd[0]] = -1;
+        if (pipefd[1] != -1) running_thread()->fdtable[pipefd[1]] = -1;
+        pipe_put(read_global_fd);
+        pipe_put(write_global_fd);
+        return -1;
+    }
     return 0;
 }
 
-// 从文件描述符 fd 指向的管道中读取 cnt 个字节到缓冲区 buf 中
-uint32_t pipe_read(int32_t local_fd, void* buf, uint32_t cnt) {
-    char* buffer = buf;
+// 创建默认大小的管道
+int32_t sys_pipe(int32_t pipefd[2]) {
+    return sys_pipe_sized(pipefd, bufsize);
+}
+
+// 管道为空时阻塞，直到有数据写入或者写端全部关闭，写端全部关闭且没有数据时返回 false
+static bool pipe_wait_data(struct pipe* p) {
+    struct ioqueue* ioq = &p->ioq;
+    while (ioq_empty(ioq)) {
+        if (p->writers == 0) return false;
+        // 多个读者时锁使它们排队，拿到锁后需要重新检查条件
+        lock_acquire(&ioq->lock);
+        if (ioq_empty(ioq) && p->writers != 0) ioq_wait(&ioq->consumer);
+        lock_release(&ioq->lock);
+    }
+    return true;
+}
+
+// 把 data 中的 len 个字节写入管道，管道满时阻塞直到读者取走数据，读端全部关闭时停止，返回写入的字节数
+static uint32_t pipe_fill(struct pipe* p, const char* data, uint32_t len) {
+    struct ioqueue* ioq = &p->ioq;
+    uint32_t bytes_write = 0;
+    while (bytes_write < len && p->readers != 0) {
+        if (ioq_full(ioq)) {
+            lock_acquire(&ioq->lock);
+            if (ioq_full(ioq) && p->readers != 0) ioq_wait(&ioq->producer);
+            lock_release(&ioq->lock);
+            continue;
+        }
+        bytes_write += ioq_write_bulk(ioq, data + bytes_write, len - bytes_write);
+    }
+    return bytes_write;
+}
+
+/* 从文件描述符 fd 指向的管道中读取最多 cnt 个字节到缓冲区 buf 中
+ * 管道为空时阻塞，直到有数据写入或者写端全部关闭，写端全部关闭且没有数据时返回 -1 */
+int32_t pipe_read(int32_t local_fd, void* buf, uint32_t cnt) {
     uint32_t bytes_read = 0;
     uint32_t global_fd = fd_local_to_global(local_fd);
 
     // 获取管道的环形缓冲区
-    struct ioqueue* ioq = (struct ioqueue*)file_table[global_fd].fd_inode;
-
-    // 选择较小的数据大小读取避免阻塞
-    uint32_t ioq_len = ioq_length(ioq);
-    uint32_t size = (ioq_len > cnt) ? cnt : ioq_len;
+    struct pipe* p = (struct pipe*)file_table[global_fd].fd_inode;
+    enum intr_status old_status = intr_disable();
 
-    while (bytes_read < size) {
-        *buffer = ioq_get_char(ioq);
-        bytes_read++;
-        buffer++;
+    if (!pipe_wait_data(p)) {
+        intr_set_status(old_status);
+        return -1;
     }
-    // printk("pipe_read %s\n", (char*)buf);
+    // 只读取已有的数据，不等待凑满 cnt 个字节
+    bytes_read = ioq_read_bulk(&p->ioq, buf, cnt);
+    intr_set_status(old_status);
     return bytes_read;
 }
 
-// 从文件描述符 fd 指向的管道中写入 cnt 个字节到缓冲区 buf 中
-uint32_t pipe_write(int32_t local_fd, const void* buf, uint32_t cnt) {
-    const char* buffer = buf;
-    uint32_t bytes_write = 0;
+/* 把缓冲区 buf 中的 cnt 个字节写入文件描述符 fd 指向的管道中
+ * 管道满时阻塞直到读者取走数据，读端全部关闭时停止写入，一个字节都没写入时返回 -1 */
+int32_t pipe_write(int32_t local_fd, const void* buf, uint32_t cnt) {
     uint32_t global_fd = fd_local_to_global(local_fd);
 
     // 获取管道的环形缓冲区
-    struct ioqueue* ioq = (struct ioqueue*)file_table[global_fd].fd_inode;
+    struct pipe* p = (struct pipe*)file_table[global_fd].fd_inode;
+    enum intr_status old_status = intr_disable();
+    uint32_t bytes_write = pipe_fill(p, buf, cnt);
+    intr_set_status(old_status);
+    return (bytes_write == 0 && cnt != 0) ? -1 : (int32_t)bytes_write;
+}
+
+// splice 的输出端：管道、屏幕、普通文件，返回消费的字节数
+static uint32_t pipe_sink(void* arg, const void* data, uint32_t len) {
+    return pipe_fill((struct pipe*)arg, data, len);
+}
+
+static uint32_t console_sink(void* arg UNUSED, const void* data, uint32_t len) {
+    console_write(data, len);
+    return len;
+}
+
+static uint32_t file_sink(void* arg, const void* data, uint32_t len) {
+    int32_t ret = file_write((struct file*)arg, data, len);
+    return ret == -1 ? 0 : (uint32_t)ret;
+}
 
-    // 选择较小的数据大小读取避免阻塞
-    uint32_t ioq_len = bufsize - ioq_length(ioq);
-    uint32_t size = (ioq_len > cnt) ? cnt : ioq_len;
+// 把管道中最多 cnt 个字节直接从环形缓冲区交给 sink，返回搬运的字节数，写端全部关闭且没有数据时返回 -1
+static int32_t pipe_drain(struct pipe* p, uint32_t cnt, file_actor sink, void* arg) {
+    if (!pipe_wait_data(p)) return -1;
 
-    while (bytes_write < size) {
-        ioq_put_char(ioq, *buffer);
-        buffer++;
-        bytes_write++;
+    uint32_t bytes_moved = 0, span = 0, consumed = 0;
+    char* data = NULL;
+    while (bytes_moved < cnt && (span = ioq_peek(&p->ioq, &data)) != 0) {
+        if (span > cnt - bytes_moved) span = cnt - bytes_moved;
+        consumed = sink(arg, data, span);
+        ioq_consume(&p->ioq, consumed);
+        bytes_moved += consumed;
+        if (consumed < span) break;
     }
-    // printk("pipe_write %s\n", (char*)buf);
-    return bytes_write;
+    return bytes_moved;
 }
 
-// 文件描述符重定向
-void sys_fd_redirect(uint32_t old_local_fd, uint32_t new_local_fd) {
+/* 在内核中把 fd_in 中最多 cnt 个字节直接搬到 fd_out，不经过用户缓冲区
+ * fd_in 为普通文件时数据直接取自块缓存，为管道时直接取自环形缓冲区；
+ * fd_out 可以是管道、标准输出或者可写的普通文件
+ * 返回搬运的字节数，fd_in 读到末尾返回 0，参数不支持或者 fd_out 一个字节都写不进去时返回 -1
+ * 同一管道的读端同时有多个读者时不要对其使用 splice，数据在交给 fd_out 后才从管道中取走 */
+int32_t sys_splice(int32_t fd_in, int32_t fd_out, uint32_t cnt) {
     struct task_struct* cur = running_thread();
-    if (new_local_fd < 3) { // 预留的标准输入输出和错误的
-        cur->fdtable[old_local_fd] = new_local_fd; 
-    } 
-    else {
-        uint32_t new_global_fd = cur->fdtable[new_local_fd];
-        cur->fdtable[old_local_fd] = new_global_fd;
+    if (fd_in < 0 || fd_in >= MAX_FILES_OPEN_PER_PROC || fd_out < 0 || fd_out >= MAX_FILES_OPEN_PER_PROC || \
+        cur->fdtable[fd_in] == -1 || cur->fdtable[fd_out] == -1 || fd_out == stdin_no) {
+        return -1;
     }
-}
\ No newline at end of file
+    struct file* in = &file_table[fd_local_to_global(fd_in)];
+    struct file* out = &file_table[fd_local_to_global(fd_out)];
+    bool in_pipe = is_pipe(fd_in), out_pipe = is_pipe(fd_out);
+    if (in_pipe ? in->fd_pos != PIPE_READ : fd_in <= 2) return -1; // 输入端只支持管道的读端和普通文件
+
+    // 选择输出端
+    file_actor sink = NULL;
+    void* arg = out;
+    if (out_pipe) {
+        if (out->fd_pos != PIPE_WRITE || (in_pipe && in->fd_inode == out->fd_inode)) return -1;
+        sink = pipe_sink;
+        arg = out->fd_inode;
+    } else if (fd_out == std_out || fd_out == std_err) {
+        sink = console_sink;
+    } else if (out->fd_flag & (O_WRONLY | O_RDWR)) {
+        sink = file_sink;
+    } else {
+        return -1;
+    }
+
+    enum intr_status old_status = intr_disable();
+    int32_t ret = in_pipe ? pipe_drain((struct pipe*)in->fd_inode, cnt, sink, arg) : \
+                            file_read_actor(in, cnt, sink, arg);
+    intr_set_status(old_status);
+
+    if (ret == -1) return 0;  // 读到末尾
+    return (ret == 0 && cnt != 0) ? -1 : ret;
+}
+
+/* 文件描述符重定向，使 old_local_fd 指向 new_local_fd 所指的文件
+ * new_local_fd 小于 3 时表示恢复为标准输入输出
+ * 管道端的引用计数随之增减，保证写端全部关闭时读者能看到 EOF */
+void sys_fd_redirect(uint32_t old_local_fd, uint32_t new_local_fd) {
+    struct task_struct* cur = running_thread();
+    int32_t new_global_fd = (new_local_fd < 3) ? (int32_t)new_local_fd : cur->fdtable[new_local_fd];
+    int32_t old_global_fd = cur->fdtable[old_local_fd];
+
+    // 先增加新的引用再释放旧的，两者为同一管道端时不会被提前释放
+    if (global_fd_is_pipe(new_global_fd)) pipe_get(new_global_fd);
+    if (old_global_fd != -1 && global_fd_is_pipe(old_global_fd)) pipe_put(old_global_fd);
+    cur->fdtable[old_local_fd] = new_global_fd;
+}
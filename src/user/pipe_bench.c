@@ -0,0 +1,48 @@
+#include <lib/stdio.h>
+#include <user/syscall.h>
+#include <kernel/string.h>
+#include <kernel/cpu.h>
+
+#define BENCH_BYTES (1024 * 1024)  // 经过管道传送的总字节数
+#define CHUNK_SIZE  4096           // 每次 read/write 的字节数
+
+// 父进程往管道中写入 BENCH_BYTES 字节，子进程读出，输出传送所用的时钟周期数
+// 用法：pipe_bench [管道缓冲区大小]
+int main(int argc, char** argv) {
+    uint32_t size = 0;
+    if (argc == 2) {
+        char* p = argv[1];
+        while (*p >= '0' && *p <= '9') size = size * 10 + (*p++ - '0');
+    }
+
+    int32_t fd[2] = {-1};
+    if ((size ? pipe_sized(fd, size) : pipe(fd)) == -1) {
+        printf("pipe_bench: create pipe failed\n");
+        return -1;
+    }
+
+    static char buf[CHUNK_SIZE];
+    int32_t pid = fork();
+    if (pid) { // 父进程写
+        close(fd[0]);
+        memset(buf, 'z', CHUNK_SIZE);
+        uint32_t bytes = 0;
+        uint64_t start = rdtsc();
+        while (bytes < BENCH_BYTES) {
+            int32_t ret = (int32_t)write(fd[1], buf, CHUNK_SIZE);
+            if (ret == -1) break;
+            bytes += ret;
+        }
+        close(fd[1]); // 子进程读到 EOF 后结束
+        int32_t status;
+        wait(&status);
+        uint32_t cycles = (uint32_t)(rdtsc() - start);
+        printf("pipe_bench: %d bytes, %d cycles, %d bytes/kcycle\n",
+               bytes, cycles, bytes / (cycles / 1000 + 1));
+        return 0;
+    } else { // 子进程读
+        close(fd[1]);
+        while (read(fd[0], buf, CHUNK_SIZE) != -1);
+        return 0;
+    }
+}
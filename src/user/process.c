@@ -1,6 +1,7 @@
 #include <kernel/thread.h>
 #include <kernel/global.h>
 #include <kernel/memory.h>
+#include <kernel/cpu.h>
 #include <user/process.h>
 #include <kernel/tss.h>
 #include <device/console.h>>
@@ -58,7 +59,8 @@ void page_dir_activate(struct task_struct* pthread) {
     // console_put_char('\n');
     
 
-    asm volatile ("movl %0, %%cr3" : : "r" (page_phy_addr) : "memory");
+    // 共享同一页目录的线程之间切换时不重新加载cr3，保留TLB
+    if (read_cr3() != page_phy_addr) write_cr3(page_phy_addr);
   
     // if (page_phy_addr != 0x100000) ASSERT( 1== 2);
 }
@@ -135,10 +137,9 @@ void process_execute(void* filename, char* name) {
     // put_char('\n');
     enum intr_status old_status = intr_disable();
     ASSERT(!elem_find(&thread_all_list, &thread->all_list_tag));
-    ASSERT(!elem_find(&thread_ready_list, &thread->general_tag));
 
     list_append(&thread_all_list, &thread->all_list_tag);
-    list_append(&thread_ready_list, &thread->general_tag);
+    ready_list_append(thread);
 
     intr_set_status(old_status);
     put_str("process_execute  "); 
@@ -103,7 +103,11 @@ static int32_t cmd_parse(char* cmd_str, char** argv, char token) {
 }
 
 
-static void cmd_execute(uint32_t argc, char** argv) {
+char* argv[MAX_ARG_NR];
+int32_t argc = -1;
+
+// 执行内部命令，argv[0] 不是内部命令时返回 false
+static bool buildin_execute(uint32_t argc, char** argv) {
     if (!strcmp(argv[0], "ls")) {
         buildin_ls(argc, argv);
     } 
@@ -120,42 +124,109 @@ static void cmd_execute(uint32_t argc, char** argv) {
     else if (!strcmp(argv[0], "rmdir")) buildin_rmdir(argc, argv);
     else if (!strcmp(argv[0], "rm"))    buildin_rm(argc, argv);
     else if (!strcmp(argv[0], "help"))  buildin_help(argc, argv);
-    else { // 执行外部命令，先 fork 出一个子进程然后调用 execv 去执行
+    else if (!strcmp(argv[0], "iostat")) buildin_iostat(argc, argv);
+    else return false;
+    return true;
+}
+
+// 在子进程中执行外部命令，execv 成功后不会返回
+static void extern_execute(char** argv) {
+    make_clear_abs_path(argv[0], final_path);
+    argv[0] = final_path;
+    struct stat file_stat;
+    memset(&file_stat, 0, sizeof(struct stat));
+    // 判断文件是否存在
+    if (stat(argv[0], &file_stat) == -1) {
+        printf("my_shell: cannot access %s: No such file or directory\n", argv[0]);
+        exit(-1);
+    } else {
+        execv(argv[0], argv);
+    }
+}
+
+/* 阻塞父进程等到子进程 exit 后返回其状态
+ * 如果所有子进程都还在运行，my_shell 会被阻塞 */
+static void wait_child(void) {
+    int32_t status;
+    int32_t child_pid = wait(&status);  
+    if (child_pid == -1) {
+        panic("my_shell: no child\n");
+    }
+    printf("child_pid: %d, it's status: %d\n", child_pid, status);
+}
+
+static void cmd_execute(uint32_t argc, char** argv) {
+    if (buildin_execute(argc, argv)) return;
+
+    // 执行外部命令，先 fork 出一个子进程然后调用 execv 去执行
+    pid_t pid = fork();
+    if (pid) { // 父进程
+        wait_child();
+    } else {
+        extern_execute(argv);
+    }
+}
+
+/* 执行 cmd1 | cmd2 | ... | cmdn
+ * 先 fork 出所有命令的子进程，每个子进程把标准输入输出重定向到相邻的管道后执行命令，
+ * 各命令同时运行，管道满了写者阻塞、空了读者阻塞，shell 最后等待所有子进程结束 */
+static void pipeline_execute(char* cmd_line) {
+    char* each_cmd = cmd_line;
+    char* pipe_symbol = NULL;
+    int32_t prev_read_fd = -1;  // 上一个命令输出管道的读端，作为本命令的标准输入
+    uint32_t child_nr = 0;
+
+    do {
+        pipe_symbol = strchr(each_cmd, '|');
+        if (pipe_symbol) *pipe_symbol = 0;
+
+        int32_t pipefd[2] = {-1, -1};
+        if (pipe_symbol && pipe(pipefd) == -1) { // 不是最后一个命令，输出到新的管道
+            printf("my_shell: create pipe failed\n");
+            break;
+        }
+
         pid_t pid = fork();
-        if (pid) { // 父进程
-            // /* 父进程一般先于子进程执行，如果不加
-            //  * 在进入下一轮循环中会将 final_path 清空
-            //  * 那么子进程无法从 final_path 中获取参数 */
-            // while(1); 
-            int32_t status;
-            /* 阻塞父进程等到子进程 exit 后返回其状态
-                * 如果所有子进程都还在运行，my_shell 会被阻塞 */
-            int32_t child_pid = wait(&status);  
-            if (child_pid == -1) {
-                panic("my_shell: no child\n");
+        if (pid == -1) {
+            printf("my_shell: fork failed\n");
+            if (pipe_symbol) {
+                close(pipefd[0]); close(pipefd[1]);
+            }
+            break;
+        }
+        if (pid == 0) { // 子进程
+            if (prev_read_fd != -1) {
+                fd_redirect(0, prev_read_fd); // 将标准输入重定向到上一个管道的读端
+                close(prev_read_fd);
             }
-            printf("child_pid: %d, it's status: %d\n", child_pid, status);
-        } else {
-            make_clear_abs_path(argv[0], final_path);
-            argv[0] = final_path;
-            struct stat file_stat;
-            memset(&file_stat, 0, sizeof(struct stat));
-            // 判断文件是否存在
-            if (stat(argv[0], &file_stat) == -1) {
-                printf("my_shell: cannot access %s: No such file or directory\n", argv[0]);
+            if (pipe_symbol) {
+                fd_redirect(1, pipefd[1]);    // 将标准输出重定向到本管道的写端
+                close(pipefd[0]); close(pipefd[1]);
+            }
+            argc = -1;
+            argc = cmd_parse(each_cmd, argv, ' ');
+            if (argc == -1) {
+                printf("num of arguments exceed %d\n", MAX_ARG_NR);
                 exit(-1);
-            } else {
-                execv(argv[0], argv);
             }
+            if (buildin_execute(argc, argv)) exit(0);
+            extern_execute(argv);
+        }
 
+        // 父进程只保留下一个命令要用的读端，其余管道端都要关闭，否则读者等不到 EOF
+        child_nr++;
+        if (prev_read_fd != -1) close(prev_read_fd);
+        prev_read_fd = pipefd[0];
+        if (pipe_symbol) {
+            close(pipefd[1]);
+            each_cmd = pipe_symbol + 1; // 跨过 '|' 处理下一个命令
         }
+    } while (pipe_symbol);
 
-    }
+    if (prev_read_fd != -1) close(prev_read_fd);
+    while (child_nr--) wait_child();
 }
 
-char* argv[MAX_ARG_NR];
-int32_t argc = -1;
-
 
 void my_shell() {
     cwd_cache[0] = '/';
@@ -170,45 +241,7 @@ void my_shell() {
 
         char* pipe_symbol = strchr(cmd_line, '|');  // 此时 pipe_symbo 的值是 cmd_line 中 ｜ 的下标
         if (pipe_symbol) { // 管道
-            int32_t pipefd[2] = {-1};
-            pipe(pipefd); // 生成管道
-            fd_redirect(1, pipefd[1]); // 将标准输出重定向到写管道
-
-            // cmd1
-            char* each_cmd = cmd_line;
-            pipe_symbol = strchr(each_cmd, '|');
-			*pipe_symbol = 0;
-
-            argc = -1;
-            argc = cmd_parse(each_cmd, argv, ' ');
-            cmd_execute(argc, argv); // 执行第一个命令
-
-            // cmd2 ~ cmdn-1
-            each_cmd = pipe_symbol + 1; // 跨过 '|' 处理下一个命令
-            fd_redirect(0, pipefd[0]);   // 将标准输入重定向到读管道
-
-            // 除了 cmd1 和 cmdn 外输入输出都需要重定向到管道缓冲区中
-            while ((pipe_symbol = strchr(each_cmd, '|'))) {
-                *pipe_symbol = 0;
-                argc = -1;
-                argc = cmd_parse(each_cmd, argv, ' ');
-                cmd_execute(argc, argv); 
-                each_cmd = pipe_symbol + 1;
-            }
-
-            // cmdn
-            fd_redirect(1, 1); // 标准输出恢复到在屏幕上显示
-
-            // 执行最后一个命令
-            argc = -1;
-            argc = cmd_parse(each_cmd, argv, ' ');
-            cmd_execute(argc, argv); // 执行第一个命令
-
-            fd_redirect(0, 0); // 标准输入恢复到从键盘中读取
-
-            // 关闭管道
-            close(pipefd[0]); close(pipefd[1]);
-
+            pipeline_execute(cmd_line);
         } else { // 普通命令不含管道
             argc = -1;
             argc = cmd_parse(cmd_line, argv, ' ');
@@ -3,6 +3,7 @@
 #include <lib/kernel/print.h>
 #include <device/console.h>
 #include <fs/fs.h>
+#include <device/ide.h>
 #include <user/fork.h>
 #include <user/exec.h>
 #include <user/pipe.h>
@@ -54,8 +55,11 @@ void syscall_init() {
     syscall_table[SYS_WAIT]  = sys_wait;
     syscall_table[SYS_EXIT]  = sys_exit;
     syscall_table[SYS_PIPE]  = sys_pipe;
+    syscall_table[SYS_PIPE_SIZED] = sys_pipe_sized;
+    syscall_table[SYS_SPLICE] = sys_splice;
 
     syscall_table[SYS_HELP]  = sys_help;
+    syscall_table[SYS_IOSTAT] = sys_iostat;
 
     syscall_table[SYS_FD_REDIRECT] = sys_fd_redirect;
 
@@ -4,15 +4,66 @@
 #include <fs/fs.h>
 #include <fs/dir.h>
 #include <user/wait_exit.h>
+#include <kernel/cpu.h>
+
+/* 系统调用的跳板，约定与 0x80 号中断相同：eax 是子功能号，ebx、ecx、edx 是参数，eax 是返回值，其余寄存器不变
+ * vsyscall_sysenter 用 sysenter 进入内核，先把 ebp、ecx、edx 和返回地址压入用户栈并令 ebp 指向返回地址，
+ * 内核从中取出参数，并用 sysexit 返回到标号 1 处；在 0 级调用时 sysexit 会回到 3 级，所以退回到 int $0x80
+ * vsyscall_probe 是第一次系统调用时的入口，选定跳板后跳转过去 */
+asm (
+    ".text\n"
+    ".globl vsyscall_int80\n"
+    "vsyscall_int80:\n"
+    "   int $0x80\n"
+    "   ret\n"
+    ".globl vsyscall_sysenter\n"
+    "vsyscall_sysenter:\n"
+    "   pushl %eax\n"
+    "   movl %cs, %eax\n"
+    "   testl $3, %eax\n"
+    "   popl %eax\n"
+    "   jz vsyscall_int80\n"
+    "   pushl %ebp\n"
+    "   pushl %ecx\n"
+    "   pushl %edx\n"
+    "   pushl $1f\n"
+    "   movl %esp, %ebp\n"
+    "   sysenter\n"
+    "1: addl $4, %esp\n"
+    "   popl %edx\n"
+    "   popl %ecx\n"
+    "   popl %ebp\n"
+    "   ret\n"
+    ".globl vsyscall_probe\n"
+    "vsyscall_probe:\n"
+    "   pushal\n"
+    "   call syscall_entry_init\n"
+    "   popal\n"
+    "   jmp *syscall_entry\n"
+);
+
+void vsyscall_int80(void);
+void vsyscall_sysenter(void);
+void vsyscall_probe(void);
+void syscall_entry_init(void);
+
+// 系统调用的入口，_syscall0~3 通过它进入内核
+void (*syscall_entry)(void) = vsyscall_probe;
+
+// 处理器支持 sysenter 时内核已经设置好了 MSR，否则使用 0x80 号中断
+void syscall_entry_init(void) {
+    syscall_entry = cpu_has_sysenter() ? vsyscall_sysenter : vsyscall_int80;
+}
 
 /**
  * 无参数的系统调用 
  * eax 既用来保存子功能号，又作为函数调用的返回值
+ * 经 syscall_entry 指向的跳板进入内核，跳板会保持除 eax 以外的寄存器不变
  */ 
 #define _syscall0(NUMBER) ({			   \
    int retval;					           \
    asm volatile (					       \
-   "int $0x80"						       \
+   "call *syscall_entry"                   \
    : "=a" (retval)					       \
    : "a" (NUMBER)					       \
    : "memory"						       \
@@ -24,7 +75,7 @@
 #define _syscall1(NUMBER, ARG1) ({		  \
    int retval;					          \
    asm volatile (					      \
-   "int $0x80"						      \
+   "call *syscall_entry"                  \
    : "=a" (retval)					      \
    : "a" (NUMBER), "b" (ARG1)   	      \
    : "memory"						      \
@@ -36,7 +87,7 @@
 #define _syscall2(NUMBER, ARG1, ARG2) ({	\
    int retval;						        \
    asm volatile (					        \
-   "int $0x80"						        \
+   "call *syscall_entry"                    \
    : "=a" (retval)					        \
    : "a" (NUMBER), "b" (ARG1), "c" (ARG2)   \
    : "memory"						        \
@@ -48,7 +99,7 @@
 #define _syscall3(NUMBER, ARG1, ARG2, ARG3) ({		        \
    int retval;						                        \
    asm volatile (					                        \
-      "int $0x80"					                        \
+      "call *syscall_entry"                                 \
       : "=a" (retval)					                    \
       : "a" (NUMBER), "b" (ARG1), "c" (ARG2), "d" (ARG3)    \
       : "memory"					                        \
@@ -221,10 +272,25 @@ int32_t pipe(int32_t pipe_fd[2]) {
    return _syscall1(SYS_PIPE, pipe_fd);
 }
 
+// 创建缓冲区大小为 size 字节的管道
+int32_t pipe_sized(int32_t pipe_fd[2], uint32_t size) {
+   return _syscall2(SYS_PIPE_SIZED, pipe_fd, size);
+}
+
+// 在内核中把 fd_in 中最多 cnt 个字节直接搬到 fd_out
+int32_t splice(int32_t fd_in, int32_t fd_out, uint32_t cnt) {
+   return _syscall3(SYS_SPLICE, fd_in, fd_out, cnt);
+}
+
 void fd_redirect(uint32_t old_local_fd, uint32_t new_local_fd) {
    _syscall2(SYS_FD_REDIRECT, old_local_fd, new_local_fd);
 }
 
 void help() {
    _syscall0(SYS_HELP);
+}
+
+// 打印硬盘请求队列的调度统计
+void iostat() {
+   _syscall0(SYS_IOSTAT);
 }
\ No newline at end of file
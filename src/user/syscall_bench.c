@@ -0,0 +1,35 @@
+#include <lib/stdio.h>
+#include <user/syscall.h>
+#include <user/vdso.h>
+#include <kernel/cpu.h>
+
+#define BENCH_ROUNDS 10000
+
+// 直接用 0x80 号中断调用 getpid，作为对照
+static uint32_t getpid_int80(void) {
+    uint32_t retval;
+    asm volatile ("int $0x80" : "=a" (retval) : "a" (SYS_GETPID) : "memory");
+    return retval;
+}
+
+// 比较 getpid 经 0x80 号中断、经 syscall_entry（支持时为 sysenter）往返一次和读 vDSO 数据页的时钟周期数
+int main(void) {
+    uint32_t round = 0;
+    uint64_t start = rdtsc();
+    while (round++ < BENCH_ROUNDS) getpid_int80();
+    uint32_t int80 = (uint32_t)(rdtsc() - start) / BENCH_ROUNDS;
+
+    round = 0;
+    start = rdtsc();
+    while (round++ < BENCH_ROUNDS) getpid();
+    uint32_t entry = (uint32_t)(rdtsc() - start) / BENCH_ROUNDS;
+
+    round = 0;
+    start = rdtsc();
+    while (round++ < BENCH_ROUNDS) vdso_getpid();
+    uint32_t vdso = (uint32_t)(rdtsc() - start) / BENCH_ROUNDS;
+
+    printf("getpid cycles/call, int 0x80: %d, syscall_entry(%s): %d, vdso: %d\n",
+           int80, cpu_has_sysenter() ? "sysenter" : "int 0x80", entry, vdso);
+    return 0;
+}
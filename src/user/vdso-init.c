@@ -0,0 +1,47 @@
+#include <user/vdso-init.h>
+#include <user/vdso.h>
+#include <kernel/memory.h>
+#include <kernel/thread.h>
+#include <kernel/debug.h>
+#include <kernel/cpu.h>
+#include <device/timer.h>
+#include <lib/kernel/print.h>
+
+#define barrier() asm volatile ("" : : : "memory")
+
+// 内核通过自己的可写映射更新数据页，用户从 VDSO_DATA_VADDR 的只读映射读取
+static struct vdso_data* vdso_kdata;
+
+// 分配数据页并以只读方式映射到 VDSO_DATA_VADDR，这张页表为所有进程共享，不需要逐个进程映射
+void vdso_init(void) {
+    put_str("vdso_init start.\n");
+    vdso_kdata = get_kernel_pages(1);
+    if (vdso_kdata == NULL) PANIC("vdso_init: alloc page failed");
+
+    *pte_ptr(VDSO_DATA_VADDR) = addr_v2p((uint32_t)vdso_kdata) | PG_US_U | PG_RW_R | PG_P_1;
+    invlpg(VDSO_DATA_VADDR);
+    put_str("vdso_init done.\n");
+}
+
+// 调度器选出 next 后调用，须在关中断下调用
+void vdso_switch(struct task_struct* cur, struct task_struct* next) {
+    vdso_kdata->seq++;
+    barrier();
+    vdso_kdata->pid = next->pid;
+    vdso_kdata->ppid = next->parent_pid;
+    vdso_kdata->elapsed_ticks = next->elapsed_ticks;
+    if (cur != next) vdso_kdata->nr_switches++;
+    barrier();
+    vdso_kdata->seq++;
+}
+
+// 时钟中断时调用，须在关中断下调用
+void vdso_tick(struct task_struct* cur) {
+    vdso_kdata->seq++;
+    barrier();
+    vdso_kdata->ticks = ticks;
+    vdso_kdata->elapsed_ticks = cur->elapsed_ticks;
+    if (cur == idle_thread) vdso_kdata->idle_ticks++;
+    barrier();
+    vdso_kdata->seq++;
+}
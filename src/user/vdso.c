@@ -0,0 +1,32 @@
+#include <user/vdso.h>
+#include <kernel/string.h>
+
+/* 读取内核映射在 VDSO_DATA_VADDR 的数据页，不需要进入内核
+ * 单个字段是对齐的 32 位数，直接读取即可，多个字段需要一致时用 vdso_snapshot */
+
+#define vdso ((const struct vdso_data*)VDSO_DATA_VADDR)
+#define barrier() asm volatile ("" : : : "memory")
+
+pid_t vdso_getpid(void) {
+    return (pid_t)vdso->pid;
+}
+
+pid_t vdso_getppid(void) {
+    return (pid_t)vdso->ppid;
+}
+
+uint32_t vdso_ticks(void) {
+    return vdso->ticks;
+}
+
+// 读出整个数据页，读取期间内核更新了数据就重读
+void vdso_snapshot(struct vdso_data* snap) {
+    uint32_t seq;
+    do {
+        seq = vdso->seq;
+        barrier();
+        memcpy(snap, (const void*)vdso, sizeof(struct vdso_data));
+        barrier();
+    } while ((seq & 1) || seq != vdso->seq);
+    snap->seq = seq;
+}
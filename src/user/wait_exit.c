@@ -9,6 +9,7 @@
 #include <fs/fs.h>
 #include <fs/file.h>
 #include <user/pipe.h>
+#include <user/exec.h>
 
 /* 回收用户进程的资源：
  * 页表中对应的物理页
@@ -55,22 +56,16 @@ static void release_prog_resource(struct task_struct* release_thread) {
     // 回收用户的虚拟地址池所占的物理内存
     uint32_t bitmap_pg_cnt = (release_thread->userprog_vaddr.vaddr_bitmap.btmp_bytes_len) / PG_SIZE;
     uint8_t* user_vaddr_pool_bitmap = release_thread->userprog_vaddr.vaddr_bitmap.bits;
-    mfree_page(PF_KERNEL, user_vaddr_pool_bitmap, bitmap_pg_cnt);
+    mfree_page_locked(PF_KERNEL, user_vaddr_pool_bitmap, bitmap_pg_cnt);
 
-    // 关闭进程中打开的文件
-    uint32_t fd_idx = 3;
+    // 关闭按需调页的区域持有的i结点
+    vma_release(release_thread);
+
+    // 关闭进程中打开的文件，被重定向为管道的标准输入输出也要关闭，否则管道另一端等不到 EOF
+    uint32_t fd_idx = 0;
     while (fd_idx < MAX_FILES_OPEN_PER_PROC) {
-        if (release_thread->fdtable[fd_idx] != -1) {
-            if (is_pipe(fd_idx)) { // 管道
-                uint32_t global_fd = fd_local_to_global(fd_idx);
-                file_table[global_fd].fd_pos--;
-                if (file_table[global_fd].fd_pos == 0) {
-                    mfree_page(PF_KERNEL, file_table[global_fd].fd_inode, 1);
-                    file_table[global_fd].fd_inode = NULL;
-                }
-            } else {
-                sys_close(fd_idx);
-            }
+        if (release_thread->fdtable[fd_idx] != -1 && (fd_idx > 2 || is_pipe(fd_idx))) {
+            sys_close(fd_idx);
         }
         fd_idx++;
     }